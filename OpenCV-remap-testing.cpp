@@ -0,0 +1,855 @@
+/*
+ * Remap engine testing for OCVWarp
+ *
+ * Benchmarks the warp remaps for transformtypes 0 to 5 on
+ * large fulldome frames, plain cv::remap against the engines in
+ * ocvwarpremap.cpp, and checks that the outputs match.
+ *
+ * usage:
+ * OpenCV-remap-testing.bin bench [mapfile] [size]
+ *   tiled remap against cv::remap, transformtypes 0 to 5
+ * OpenCV-remap-testing.bin fused [mapfile] [size]
+ *   transformtype 5 as one fused remap against 1 followed by 4
+ * OpenCV-remap-testing.bin gain [mapfile] [size]
+ *   transformtype 4 remap with the mesh intensity applied in the same
+ *   pass, against cv::remap followed by cv::multiply
+ * OpenCV-remap-testing.bin mesh [mapfile] [size]
+ *   transformtype 4 evaluated from the mesh on the fly, against
+ *   expanding the mesh to full size maps and remapping
+ * OpenCV-remap-testing.bin raster [mapfile] [size]
+ *   mesh to full size maps, scan converting the mesh triangles against
+ *   the regular grid lookup, default sizes 1920, 4096 and 8192
+ * OpenCV-remap-testing.bin stream [mapfile] [size]
+ *   transformtypes 0 to 5 in row bands with only the source rows each
+ *   band reads resident, against warp_frame, time and memory held
+ * OpenCV-remap-testing.bin crop [mapfile] [size]
+ *   how much of the source each transformtype reads, and converting a
+ *   16 bit frame only there against converting all of it
+ * OpenCV-remap-testing.bin planar [mapfile] [size]
+ *   transformtype 4 on split colour planes against interleaved BGR,
+ *   default sizes 1920 and 3840 (1080p and 4K UHD outputs)
+ * OpenCV-remap-testing.bin i420 [mapfile] [size]
+ *   transformtypes 0 to 5 remapped in YUV 4:2:0, against converting
+ *   to BGR, remapping and converting back
+ * OpenCV-remap-testing.bin mip [mapfile] [size]
+ *   transformtypes 0 to 5 sampled from a mip pyramid by the map footprint,
+ *   against bilinear and 2x supersampling, PSNR against 4x supersampling,
+ *   and the lazy tile pyramid against building every level, default sizes 1024 and 2048
+ * OpenCV-remap-testing.bin profiles [mapfile] [size]
+ *   warp throughput of the preview, standard and master interpolation
+ *   profiles for transformtypes 0 to 5, default sizes 1920 and 3840
+ * OpenCV-remap-testing.bin refine [mapfile] [size]
+ *   time to the first 1/4 size preview and each refinement after an angle
+ *   change, against building the maps and warping at full size
+ *   mapfile defaults to EP_xyuv_1920.map, size is the dome master
+ *   width in pixels, default runs both 4096 and 8192.
+ *
+ * OpenCV-remap-testing.bin warp <inifile> <input> <output> [workers]
+ *   warps a video like OCVWarp, with the settings from an OCVWarp.ini,
+ *   through the decode / warp / encode pipeline with workers warp
+ *   threads (default one per core), or 0 for the sequential loop.
+ *   --overlap is that loop with decoding and encoding on their own threads.
+ *   options: --blend applies the mesh intensity for transformtypes 4 & 5,
+ *   --gamma=2.2 does that blending in linear light (not with --mesh),
+ *   --mesh warps transformtype 4 from the mesh without full size maps,
+ *   --planar remaps split colour planes instead of interleaved BGR,
+ *   --mip samples minified areas from a mip pyramid, without aliasing,
+ *   --stream warps in bands of rows, making the maps of each band as it
+ *   goes instead of holding full size maps (also for batch),
+ *   --profile=preview|standard|master picks the interpolation, overriding
+ *   the optional profile line at the end of the ini,
+ *   --ffmpeg decodes and encodes with ffmpeg processes and warps in YUV,
+ *   no BGR conversion, the other options do not apply,
+ *   --segments splits the video into workers segments encoded in parallel
+ *   and joined with ffmpeg, for long videos,
+ *   --start-frame=f --end-frame=f warp only input frames f .. end-1, seeking
+ *   to the keyframe before the start (also for batch and yuv).
+ *   An input or output ending in .ocvw is a lossless intermediate file,
+ *   see ocvwarpraw.h, for jobs done in several passes.
+ *   --timing keeps per frame decode / maps / warp / encode times and prints
+ *   their percentiles every 10 s (--timing-every=s) and at the end,
+ *   --timing=report.json or .csv also writes them to that file.
+ *
+ * OpenCV-remap-testing.bin batch <inifile> <inputpattern> <outputpattern> [workers]
+ *   warps an image sequence, patterns like in%05d.png, with the frames
+ *   split across workers threads which each read, warp and write their share.
+ *   options: --codecs=n decodes and encodes the files on n threads each
+ *   instead, reading ahead, with workers threads only warping,
+ *   --compression=c is the PNG zlib level, JPEG / WebP quality or TIFF
+ *   compression scheme of the output files, or fast for lossless output
+ *   tuned for speed (PNG zlib level 1, TIFF PackBits). It also applies to
+ *   warp with Output_fps 0.
+ *
+ * OpenCV-remap-testing.bin yuv <inifile> <input> <output> <width>x<height>
+ *   warps raw I420 frames of width x height, - for stdin / stdout, so that
+ *   ffmpeg can decode and encode around it with no BGR conversion.
+ *
+ * OpenCV-remap-testing.bin tune <inifile> <input>
+ *   AngleX and AngleY trackbars over a preview of the first frame, drawn at
+ *   1/4 size while they move and refined to full size when they stop.
+ *
+ * OpenCV-remap-testing.bin codecs [container] [fourcc ...]
+ *   which fourccs this OpenCV build can write to the container (default
+ *   .avi), probed once and cached, see ocvwarpcodecs.h.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <opencv2/opencv.hpp>
+#include "ocvwarpmaps.h"
+#include "ocvwarpremap.h"
+#include "ocvwarppipeline.h"
+#include "ocvwarppreview.h"
+#include "ocvwarpcodecs.h"
+#define CVUI_IMPLEMENTATION
+#include "cvui.h"
+#define WINDOW_NAME "OCVWARP PREVIEW - HIT <esc> TO CLOSE"
+
+using namespace cv;
+
+// mean wall time of f in ms, after one untimed warm-up run
+static double time_ms(const std::function<void()> &f, int iterations)
+{
+	f();
+	int64 t0 = getTickCount();
+	for (int k = 0; k < iterations; k++)
+		f();
+	return (getTickCount() - t0) * 1000.0 / getTickFrequency() / iterations;
+}
+
+// input and output sizes for a dome master of width N, like the shipped ini
+static WarpParams bench_params(int transformtype, int N, const std::string &mapfile)
+{
+	WarpParams p;
+	p.transformtype = transformtype;
+	p.anglex = 0;
+	p.angley = -90;
+	p.mapfile = mapfile;
+	switch (transformtype)
+	{
+	case 0:
+	case 1:
+		p.inputsize = Size(2 * N, N);
+		p.outputsize = Size(N, N);
+		break;
+	case 2:
+	case 3:
+		p.inputsize = Size(N, N);
+		p.outputsize = Size(N, N / 2);
+		break;
+	case 4:
+		p.inputsize = Size(N, N);
+		p.outputsize = Size(N, N * 9 / 16);
+		break;
+	default:
+		p.inputsize = Size(2 * N, N);
+		p.outputsize = Size(N, N * 9 / 16);
+		break;
+	}
+	return p;
+}
+
+static void bench_tiled(int N, const std::string &mapfile, int iterations)
+{
+	for (int transformtype = 0; transformtype <= 5; transformtype++)
+	{
+		WarpParams p = bench_params(transformtype, N, mapfile);
+		WarpMaps maps;
+		if (!build_warp_maps(p, maps))
+			continue;
+
+		Mat src(p.inputsize, CV_8UC3);
+		randu(src, Scalar::all(0), Scalar::all(255));
+		Mat dstfloat, dstfixed, dsttiled, mid;
+
+		// fixed point maps are what cv::remap uses internally anyway,
+		// converting them once is the fair baseline for the tiled engine
+		Mat fix1, fix2, fix2_1, fix2_2;
+		convertMaps(maps.map_x, maps.map_y, fix1, fix2, CV_16SC2, false);
+		TiledRemap plan, plan2;
+		plan_tiled_remap(maps.map_x, maps.map_y, maps.srcsize, plan);
+		if (!maps.map2_x.empty())
+		{
+			convertMaps(maps.map2_x, maps.map2_y, fix2_1, fix2_2, CV_16SC2, false);
+			plan_tiled_remap(maps.map2_x, maps.map2_y, maps.midsize, plan2);
+		}
+
+		double tfloat = time_ms([&]() { warp_frame(src, dstfloat, maps); }, iterations);
+		double tfixed = time_ms([&]()
+		{
+			if (maps.map2_x.empty())
+				remap(src, dstfixed, fix1, fix2, INTER_LINEAR, BORDER_CONSTANT, Scalar::all(0));
+			else
+			{
+				remap(src, mid, fix1, fix2, INTER_LINEAR, BORDER_CONSTANT, Scalar::all(0));
+				remap(mid, dstfixed, fix2_1, fix2_2, INTER_LINEAR, BORDER_CONSTANT, Scalar::all(0));
+			}
+		}, iterations);
+		double ttiled = time_ms([&]()
+		{
+			if (maps.map2_x.empty())
+				tiled_remap(src, dsttiled, plan);
+			else
+			{
+				tiled_remap(src, mid, plan);
+				tiled_remap(mid, dsttiled, plan2);
+			}
+		}, iterations);
+
+		printf("%dx%d type %d: remap float maps %8.2f ms, remap fixed maps %8.2f ms, tiled %8.2f ms (%lu bins), speedup %.2fx, maxdiff %g\n",
+			p.outputsize.width, p.outputsize.height, transformtype, tfloat, tfixed, ttiled,
+			(unsigned long)plan.binstart.size() - 1, tfixed / ttiled, norm(dstfixed, dsttiled, NORM_INF));
+	}
+}
+
+static void bench_fused(int N, const std::string &mapfile, int iterations)
+{
+	WarpParams p = bench_params(5, N, mapfile);
+	WarpMaps twopass, fused;
+	if (!build_warp_maps(p, twopass, false) || !build_warp_maps(p, fused, true))
+		return;
+
+	Mat src(p.inputsize, CV_8UC3);
+	randu(src, Scalar::all(0), Scalar::all(255));
+	Mat dsttwopass, dstfused;
+	double ttwopass = time_ms([&]() { warp_frame(src, dsttwopass, twopass); }, iterations);
+	double tfused = time_ms([&]() { warp_frame(src, dstfused, fused); }, iterations);
+
+	// not bit exact - the fused output skips one interpolation
+	printf("%dx%d type 5: 1 then 4 %8.2f ms (%dx%d intermediate), fused %8.2f ms, speedup %.2fx, mean abs diff %.3f\n",
+		p.outputsize.width, p.outputsize.height, ttwopass, twopass.midsize.width, twopass.midsize.height,
+		tfused, ttwopass / tfused, norm(dsttwopass, dstfused, NORM_L1) / ((double)dstfused.total() * dstfused.channels()));
+}
+
+static int warp_video(int argc, char *argv[])
+{
+	// positional arguments, then --options anywhere
+	std::vector<std::string> args;
+	bool blend = false, meshwarp = false, planar = false, mip = false, ffmpeg = false, segments = false;
+	bool overlap = false, stream = false;
+	int profile = -1, codecs = 0, compression = -1;
+	long long startframe = 0, endframe = -1;
+	bool timing = false;
+	std::string timingfile;
+	double timingevery = 10;
+	float gamma = 1.0f;
+	for (int k = 2; k < argc; k++)
+	{
+		if (strcmp(argv[k], "--blend") == 0)
+			blend = true;
+		else if (strcmp(argv[k], "--mesh") == 0)
+			meshwarp = true;
+		else if (strcmp(argv[k], "--planar") == 0)
+			planar = true;
+		else if (strcmp(argv[k], "--mip") == 0)
+			mip = true;
+		else if (strcmp(argv[k], "--ffmpeg") == 0)
+			ffmpeg = true;
+		else if (strcmp(argv[k], "--stream") == 0)
+			stream = true;
+		else if (strcmp(argv[k], "--overlap") == 0)
+			overlap = true;
+		else if (strcmp(argv[k], "--segments") == 0)
+			segments = true;
+		else if (strncmp(argv[k], "--profile=", 10) == 0)
+		{
+			profile = interpolation_profile(argv[k] + 10);
+			if (profile < 0)
+			{
+				printf("Unknown profile %s, use preview, standard or master\n", argv[k] + 10);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[k], "--codecs=", 9) == 0)
+			codecs = atoi(argv[k] + 9);
+		else if (strncmp(argv[k], "--start-frame=", 14) == 0)
+			startframe = atoll(argv[k] + 14);
+		else if (strncmp(argv[k], "--end-frame=", 12) == 0)
+			endframe = atoll(argv[k] + 12);
+		else if (strcmp(argv[k], "--timing") == 0)
+			timing = true;
+		else if (strncmp(argv[k], "--timing=", 9) == 0)
+		{
+			timing = true;
+			timingfile = argv[k] + 9;
+		}
+		else if (strncmp(argv[k], "--timing-every=", 15) == 0)
+			timingevery = atof(argv[k] + 15);
+		else if (strcmp(argv[k], "--compression=fast") == 0)
+			compression = COMPRESSION_FAST;
+		else if (strncmp(argv[k], "--compression=", 14) == 0)
+			compression = atoi(argv[k] + 14);
+		else if (strncmp(argv[k], "--gamma=", 8) == 0)
+			gamma = (float)atof(argv[k] + 8);
+		else if (strncmp(argv[k], "--", 2) == 0)
+		{
+			printf("Unknown option %s\n", argv[k]);
+			return 1;
+		}
+		else
+			args.push_back(argv[k]);
+	}
+
+	WarpJob job;
+	if (args.size() < 3)
+	{
+		printf("usage: %s %s <inifile> <input> <output> [workers] [--blend] [--gamma=g] [--mesh] [--planar] [--mip] [--stream] [--profile=p] [--overlap] [--ffmpeg] [--segments] [--codecs=n] [--compression=c] [--start-frame=f] [--end-frame=f] [--timing[=report.json|csv]]\n", argv[0], argv[1]);
+		return 1;
+	}
+	if (!read_ocvwarp_ini(args[0], job))
+	{
+		printf("Could not read ini file %s\n", args[0].c_str());
+		return 1;
+	}
+	job.inputfile = args[1];
+	job.outputfile = args[2];
+	job.blend = blend;
+	job.gamma = gamma;
+	job.meshwarp = meshwarp;
+	job.planar = planar;
+	job.mip = mip;
+	job.stream = stream;
+	job.compression = compression;
+	job.startframe = startframe;
+	job.endframe = endframe;
+	// the command line wins over the ini
+	if (profile >= 0)
+		job.profile = profile;
+	PipelineStats stats;
+	bool ok;
+	int w = 0, h = 0;
+	if (strcmp(argv[1], "yuv") == 0 && (args.size() < 4 || sscanf(args[3].c_str(), "%dx%d", &w, &h) != 2))
+	{
+		printf("usage: %s yuv <inifile> <input> <output> <width>x<height>\n", argv[0]);
+		return 1;
+	}
+	// keep stdout clean when the frames go there
+	FILE *report = job.outputfile == "-" ? stderr : stdout;
+	StageTimes times;
+	if (timing)
+	{
+		job.timing = &times;
+		times.start_printing(timingevery, stderr);
+	}
+	int nworkers = args.size() > 3 ? atoi(args[3].c_str()) : getNumberOfCPUs();
+
+	if (strcmp(argv[1], "yuv") == 0)
+		ok = run_warp_yuv(job, Size(w, h), stats);
+	else if (ffmpeg)
+		ok = run_warp_ffmpeg(job, stats);
+	else if (segments)
+		ok = run_warp_segments(job, nworkers, stats);
+	else if (strcmp(argv[1], "batch") == 0 && codecs > 0)
+		ok = run_sequence_pipeline(job, nworkers, codecs, stats);
+	else if (strcmp(argv[1], "batch") == 0)
+		ok = run_sequence_batch(job, nworkers, stats);
+	else if (overlap)
+		ok = run_warp_overlapped(job, stats);
+	else if (nworkers == 0)
+		ok = run_warp_sequential(job, stats);
+	else
+		ok = run_warp_pipeline(job, nworkers, stats);
+	times.stop_printing();
+	if (!ok)
+		return 1;
+	print_pipeline_stats(stats, report);
+	if (timing)
+	{
+		times.print(report);
+		if (!timingfile.empty() && !times.write_report(timingfile))
+			fprintf(stderr, "Could not write %s\n", timingfile.c_str());
+	}
+	return 0;
+}
+
+static void bench_gain(int N, const std::string &mapfile, int iterations)
+{
+	WarpParams p = bench_params(4, N, mapfile);
+	WarpMaps maps;
+	if (!build_warp_maps(p, maps))
+		return;
+
+	Mat src(p.inputsize, CV_8UC3);
+	randu(src, Scalar::all(0), Scalar::all(255));
+	Mat gain3, remapped, dsttwopass, dstfused, dstgamma;
+	Mat g[3] = { maps.gain, maps.gain, maps.gain };
+	merge(g, 3, gain3);
+	GainRemap plan, gammaplan;
+	plan_gain_remap(maps.map_x, maps.map_y, maps.gain, maps.srcsize, 1.0f, plan);
+	plan_gain_remap(maps.map_x, maps.map_y, maps.gain, maps.srcsize, 2.2f, gammaplan);
+
+	double ttwopass = time_ms([&]()
+	{
+		remap(src, remapped, maps.map_x, maps.map_y, INTER_LINEAR, BORDER_CONSTANT, Scalar::all(0));
+		multiply(remapped, gain3, dsttwopass, 1, CV_8U);
+	}, iterations);
+	double tfused = time_ms([&]() { gain_remap(src, dstfused, plan); }, iterations);
+	double tgamma = time_ms([&]() { gain_remap(src, dstgamma, gammaplan); }, iterations);
+
+	size_t unity = 0, scaled = 0;
+	for (size_t k = 0; k < plan.spans.size(); k++)
+	{
+		if (plan.spans[k].kind == GAINSPAN_UNITY)
+			unity += plan.spans[k].end - plan.spans[k].start;
+		else if (plan.spans[k].kind == GAINSPAN_SCALE)
+			scaled += plan.spans[k].end - plan.spans[k].start;
+	}
+	printf("%dx%d type 4: remap + multiply %8.2f ms, fused gain %8.2f ms, fused gamma 2.2 %8.2f ms, speedup %.2fx, maxdiff %g, %.1f%% of pixels at unity gain, %.1f%% scaled\n",
+		p.outputsize.width, p.outputsize.height, ttwopass, tfused, tgamma, ttwopass / tfused,
+		norm(dsttwopass, dstfused, NORM_INF), 100.0 * unity / maps.gain.total(), 100.0 * scaled / maps.gain.total());
+}
+
+static void bench_mesh(int N, const std::string &mapfile, int iterations)
+{
+	WarpParams p = bench_params(4, N, mapfile);
+	WarpMesh mesh;
+	if (!read_mesh_file(mapfile, mesh))
+	{
+		printf("Could not read map file %s\n", mapfile.c_str());
+		return;
+	}
+
+	Mat src(p.inputsize, CV_8UC3);
+	randu(src, Scalar::all(0), Scalar::all(255));
+	Mat map_x, map_y, gain, fix1, fix2, dstdense, dstmesh;
+	MeshWarp plan;
+
+	// map building is timed too, it is redone whenever the map changes
+	double tdensemaps = time_ms([&]()
+	{
+		warped_from_fisheye_map(mesh, p.inputsize, p.outputsize, map_x, map_y, gain);
+		convertMaps(map_x, map_y, fix1, fix2, CV_16SC2, false);
+	}, iterations);
+	double tmeshplan = time_ms([&]() { plan_mesh_warp(mesh, p.inputsize, p.outputsize, plan); }, iterations);
+	double tdense = time_ms([&]() { remap(src, dstdense, fix1, fix2, INTER_LINEAR, BORDER_CONSTANT, Scalar::all(0)); }, iterations);
+	double tmesh = time_ms([&]() { mesh_warp(src, dstmesh, plan); }, iterations);
+
+	double densemb = (map_x.total() * 3 * sizeof(float) + fix1.total() * 6) / 1048576.0;
+	double meshmb = (plan.uv.total() * 3 * sizeof(float) + plan.cellstart.size() * sizeof(int)) / 1048576.0;
+	printf("%dx%d type 4: dense maps %8.2f ms + remap %8.2f ms, %.1f MB; mesh plan %8.3f ms + warp %8.2f ms, %.3f MB; maxdiff %g\n",
+		p.outputsize.width, p.outputsize.height, tdensemaps, tdense, densemb, tmeshplan, tmesh, meshmb,
+		norm(dstdense, dstmesh, NORM_INF));
+}
+
+static void bench_stream(int N, const std::string &mapfile, int iterations)
+{
+	for (int transformtype = 0; transformtype <= 5; transformtype++)
+	{
+		WarpParams p = bench_params(transformtype, N, mapfile);
+		WarpMaps maps;
+		StreamingRemap plan;
+		if (!build_warp_maps(p, maps) || !plan_streaming_remap(p, plan))
+			continue;
+
+		Mat src(p.inputsize, CV_8UC3);
+		randu(src, Scalar::all(0), Scalar::all(255));
+		Mat dstframe, dststream;
+		size_t resident = 0;
+		double tframe = time_ms([&]() { warp_frame(src, dstframe, maps); }, iterations);
+		double tstream = time_ms([&]() { streaming_remap(src, dststream, plan, INTER_LINEAR, &resident); }, iterations);
+
+		// whole frame: source, output and both float maps
+		double framemb = (src.total() * src.elemSize() + dstframe.total() * dstframe.elemSize()
+			+ 2 * maps.map_x.total() * sizeof(float)) / 1048576.0;
+		printf("type %d %dx%d -> %dx%d: frame %8.2f ms %7.1f MB, %4d bands %8.2f ms %7.1f MB, max diff %g\n",
+			transformtype, p.inputsize.width, p.inputsize.height, p.outputsize.width, p.outputsize.height,
+			tframe, framemb, (int)plan.bands.size(), tstream, resident / 1048576.0,
+			norm(dstframe, dststream, NORM_INF));
+	}
+}
+
+static void bench_crop(int N, const std::string &mapfile, int iterations)
+{
+	for (int transformtype = 0; transformtype <= 5; transformtype++)
+	{
+		WarpParams p = bench_params(transformtype, N, mapfile);
+		WarpMaps maps;
+		if (!build_warp_maps(p, maps))
+			continue;
+
+		// 16 bit, like a PNG or TIFF sequence, converted to 8 bit for the warp
+		Mat frame(p.inputsize, CV_16UC3);
+		randu(frame, Scalar::all(0), Scalar::all(65535));
+		Mat full, cropped, dstfull, dstcropped;
+		double tfull = time_ms([&]() { frame.convertTo(full, CV_8UC3, 1.0 / 256); }, iterations);
+		double tcrop = time_ms([&]() { convert_source(frame, cropped, maps); }, iterations);
+		warp_frame(full, dstfull, maps);
+		warp_frame(cropped, dstcropped, maps);
+
+		double bandarea = 0;
+		for (size_t b = 0; b < maps.srcbands.size(); b++)
+			bandarea += maps.srcbands[b].area();
+		printf("type %d %dx%d: box %5.1f%%, bands %5.1f%% of the source, convert all %8.2f ms, bands %8.2f ms, max diff %g\n",
+			transformtype, p.inputsize.width, p.inputsize.height,
+			100.0 * maps.srcbox.area() / p.inputsize.area(), 100.0 * bandarea / p.inputsize.area(),
+			tfull, tcrop, norm(dstfull, dstcropped, NORM_INF));
+	}
+}
+
+static void bench_planar(int N, const std::string &mapfile, int iterations)
+{
+	WarpParams p = bench_params(4, N, mapfile);
+	WarpMaps maps;
+	if (!build_warp_maps(p, maps))
+		return;
+
+	Mat src(p.inputsize, CV_8UC3);
+	randu(src, Scalar::all(0), Scalar::all(255));
+	Mat fix1, fix2, dstinter, dstplanar;
+	convertMaps(maps.map_x, maps.map_y, fix1, fix2, CV_16SC2, false);
+	PlanarRemap plan;
+	plan_planar_remap(maps.map_x, maps.map_y, maps.srcsize, plan);
+	std::vector<Mat> srcplanes, dstplanes;
+	split(src, srcplanes);
+
+	double tinter = time_ms([&]() { remap(src, dstinter, fix1, fix2, INTER_LINEAR, BORDER_CONSTANT, Scalar::all(0)); }, iterations);
+	double tremap = time_ms([&]() { planar_remap(srcplanes, dstplanes, plan); }, iterations);
+	double tround = time_ms([&]()
+	{
+		split(src, srcplanes);
+		planar_remap(srcplanes, dstplanes, plan);
+		merge(dstplanes, dstplanar);
+	}, iterations);
+	printf("transformtype 4 %dx%d -> %dx%d: interleaved remap %8.2f ms, planar remap %8.2f ms, with split and merge %8.2f ms, max diff %g\n",
+		p.inputsize.width, p.inputsize.height, p.outputsize.width, p.outputsize.height,
+		tinter, tremap, tround, norm(dstinter, dstplanar, NORM_INF));
+}
+
+static void bench_i420(int N, const std::string &mapfile, int iterations)
+{
+	for (int transformtype = 0; transformtype <= 5; transformtype++)
+	{
+		WarpParams p = bench_params(transformtype, N, mapfile);
+		WarpMaps maps;
+		if (!build_warp_maps(p, maps))
+			continue;
+
+		Mat bgr(p.inputsize, CV_8UC3), src, srcbgr, dstbgr, dstyuv, dstref;
+		randu(bgr, Scalar::all(0), Scalar::all(255));
+		cvtColor(bgr, src, COLOR_BGR2YUV_I420);
+		YuvRemap plan;
+		plan_yuv_remap(maps.map_x, maps.map_y, maps.srcsize, plan);
+
+		// what the frame path does today, decoder and encoder formats being I420
+		double tbgr = time_ms([&]()
+		{
+			cvtColor(src, srcbgr, COLOR_YUV2BGR_I420);
+			warp_frame(srcbgr, dstbgr, maps);
+			cvtColor(dstbgr, dstref, COLOR_BGR2YUV_I420);
+		}, iterations);
+		double tyuv = time_ms([&]() { yuv_remap(src, dstyuv, plan); }, iterations);
+
+		// luma should match closely, chroma is sampled once instead of per pixel then averaged
+		Mat ly = dstyuv.rowRange(0, p.outputsize.height), ry = dstref.rowRange(0, p.outputsize.height);
+		Mat lc = dstyuv.rowRange(p.outputsize.height, dstyuv.rows), rc = dstref.rowRange(p.outputsize.height, dstref.rows);
+		printf("type %d %dx%d -> %dx%d: BGR round trip %8.2f ms, I420 remap %8.2f ms, luma mean diff %.2f, chroma mean diff %.2f\n",
+			transformtype, p.inputsize.width, p.inputsize.height, p.outputsize.width, p.outputsize.height,
+			tbgr, tyuv, norm(ly, ry, NORM_L1) / ly.total(), norm(lc, rc, NORM_L1) / lc.total());
+	}
+}
+
+// dst at scale times the output size of p, taken down to the output size by area averaging
+static void supersampled_warp(const Mat &src, Mat &dst, const WarpParams &p, const WarpMaps &big)
+{
+	Mat large;
+	warp_frame(src, large, big);
+	resize(large, dst, p.outputsize, 0, 0, INTER_AREA);
+}
+
+static void bench_mip(int N, const std::string &mapfile, int iterations)
+{
+	for (int transformtype = 0; transformtype <= 5; transformtype++)
+	{
+		WarpParams p = bench_params(transformtype, N, mapfile);
+		WarpParams p2 = p, p4 = p;
+		p2.outputsize = Size(p.outputsize.width * 2, p.outputsize.height * 2);
+		p4.outputsize = Size(p.outputsize.width * 4, p.outputsize.height * 4);
+		WarpMaps maps, maps2, maps4;
+		if (!build_warp_maps(p, maps) || !build_warp_maps(p2, maps2) || !build_warp_maps(p4, maps4))
+			continue;
+
+		// fine detail everywhere, so that any aliasing shows
+		Mat src(p.inputsize, CV_8UC3);
+		randu(src, Scalar::all(0), Scalar::all(255));
+		GaussianBlur(src, src, Size(3, 3), 0.7);
+		MipRemap plan;
+		plan_mip_remap(maps.map_x, maps.map_y, maps.srcsize, plan);
+		std::vector<Mat> pyramid;
+		Mat dstlinear, dstss2, dstmip, dstlazy, reference;
+
+		double tlinear = time_ms([&]() { warp_frame(src, dstlinear, maps); }, iterations);
+		double tss2 = time_ms([&]() { supersampled_warp(src, dstss2, p, maps2); }, iterations);
+		double tmip = time_ms([&]()
+		{
+			build_mip_pyramid(src, pyramid, plan);
+			mip_remap(pyramid, dstmip, plan);
+		}, iterations);
+		int built = 0, tiles = 0;
+		double tlazy = time_ms([&]()
+		{
+			LazyMipPyramid lazy(src, plan);
+			mip_remap(lazy, dstlazy, plan);
+			built = lazy.tiles_built();
+		}, iterations);
+		for (int L = 1; L < plan.levels; L++)
+			tiles += ((plan.levelsizes[L].width + plan.tilesize - 1) / plan.tilesize)
+				* ((plan.levelsizes[L].height + plan.tilesize - 1) / plan.tilesize);
+		supersampled_warp(src, reference, p, maps4);
+
+		double minified = 100.0 * countNonZero(plan.lod > 0) / plan.lod.total();
+		printf("type %d %dx%d: %4.1f%% minified, bilinear %8.2f ms %5.2f dB, 2x supersampled %8.2f ms %5.2f dB, mip %8.2f ms %5.2f dB\n",
+			transformtype, p.outputsize.width, p.outputsize.height, minified,
+			tlinear, PSNR(dstlinear, reference), tss2, PSNR(dstss2, reference), tmip, PSNR(dstmip, reference));
+		printf("  lazy pyramid %8.2f ms, %d of %d tiles built, max diff from the full pyramid %g\n",
+			tlazy, built, tiles, norm(dstmip, dstlazy, NORM_INF));
+	}
+}
+
+static void bench_profiles(int N, const std::string &mapfile, int iterations)
+{
+	for (int transformtype = 0; transformtype <= 5; transformtype++)
+	{
+		WarpJob job;
+		job.params = bench_params(transformtype, N, mapfile);
+		job.anglexincr = job.angleyincr = 0;
+		job.blend = job.meshwarp = job.planar = job.mip = false;
+		job.gamma = 1.0f;
+
+		Mat src(job.params.inputsize, CV_8UC3);
+		randu(src, Scalar::all(0), Scalar::all(255));
+		printf("type %d %dx%d -> %dx%d:", transformtype, job.params.inputsize.width, job.params.inputsize.height,
+			job.params.outputsize.width, job.params.outputsize.height);
+		for (int profile = PROFILE_PREVIEW; profile <= PROFILE_MASTER; profile++)
+		{
+			job.profile = profile;
+			FrameWarp fw;
+			if (!prepare_frame_warp(job, job.params, 0, fw))
+				break;
+			Mat dst;
+			double t = time_ms([&]() { apply_frame_warp(src, dst, fw); }, iterations);
+			// an hour at 30 fps, warp only
+			printf(" %s %7.2f ms (%6.1f fps, %5.1f min/hour)", profile_name(profile), t, 1000.0 / t, t * 108000 / 60000.0);
+		}
+		printf("\n");
+	}
+}
+
+// whether each fourcc can be written to the container, probed once per OpenCV build
+static int list_codecs(int argc, char *argv[])
+{
+	std::string container = argc > 2 ? argv[2] : ".avi";
+	std::vector<std::string> fourccs;
+	for (int k = 3; k < argc; k++)
+		fourccs.push_back(argv[k]);
+	if (fourccs.empty())
+	{
+		// the usual ones from build/fourcc.txt
+		const char *common[] = { "XVID", "DIVX", "MJPG", "MP4V", "mp4v", "H264", "X264", "avc1",
+			"HEVC", "hvc1", "FFV1", "VP80", "VP90", "AV01" };
+		fourccs.assign(common, common + sizeof(common) / sizeof(common[0]));
+	}
+	printf("OpenCV build %s, cache %s\n", codec_build_key().c_str(), codec_cache_path().c_str());
+	for (size_t k = 0; k < fourccs.size(); k++)
+	{
+		bool cached = false;
+		bool ok = codec_available(fourccs[k], container, &cached);
+		printf("%s %s %s%s\n", fourccs[k].c_str(), container.c_str(), ok ? "yes" : "no",
+			cached ? " (cached)" : "");
+	}
+	return 0;
+}
+
+// the first frame of input, warped with AngleX / AngleY set by trackbars
+static int tune_angles(int argc, char *argv[])
+{
+	WarpJob job;
+	if (argc < 4 || !read_ocvwarp_ini(argv[2], job))
+	{
+		printf("usage: %s tune <inifile> <input>\n", argv[0]);
+		return 1;
+	}
+	VideoCapture cap(argv[3]);
+	Mat src;
+	if (!cap.read(src) || src.empty())
+	{
+		printf("Could not read a frame from %s\n", argv[3]);
+		return 1;
+	}
+	job.params.inputsize = src.size();
+	ProgressiveWarp preview(job.params);
+	if (!preview.ok())
+		return 1;
+
+	float anglex = job.params.anglex, angley = job.params.angley;
+	const Size view(960, 540);
+	Mat frame(view.height + 140, view.width + 20, CV_8UC3), shown;
+	cvui::init(WINDOW_NAME);
+	for (;;)
+	{
+		frame = Scalar(49, 52, 49);
+		cvui::text(frame, 10, 10, "AngleX");
+		cvui::trackbar(frame, 70, 0, view.width - 60, &anglex, -180.0f, 180.0f);
+		cvui::text(frame, 10, 60, "AngleY");
+		cvui::trackbar(frame, 70, 50, view.width - 60, &angley, -180.0f, 180.0f);
+		preview.set_angles(anglex, angley);
+		// about 30 fps for the UI, the rest of the frame goes to refining
+		preview.step(src, 30.0);
+
+		const Mat &img = preview.image();
+		if (!img.empty())
+		{
+			double k = std::min((double)view.width / img.cols, (double)view.height / img.rows);
+			resize(img, shown, Size((int)(img.cols * k), (int)(img.rows * k)), 0, 0,
+				k < 1 ? INTER_AREA : INTER_NEAREST);
+			cvui::image(frame, 10, 110, shown);
+			cvui::printf(frame, 10, view.height + 120, 0.4, 0xcecece, "1/%d size, rendered in %.1f ms%s",
+				preview.scale(), preview.render_ms(), preview.done() ? "" : ", refining");
+		}
+		cvui::update();
+		cv::imshow(WINDOW_NAME, frame);
+		if (waitKey(1) == 27)
+			break;
+	}
+	// for the ini file
+	printf("AngleX %.2f AngleY %.2f\n", anglex, angley);
+	return 0;
+}
+
+static void bench_refine(int N, const std::string &mapfile, int iterations)
+{
+	for (int transformtype = 0; transformtype <= 5; transformtype++)
+	{
+		WarpParams p = bench_params(transformtype, N, mapfile);
+		WarpMaps maps;
+		Mat src(p.inputsize, CV_8UC3), dst;
+		randu(src, Scalar::all(0), Scalar::all(255));
+		// what a full conversion of one frame costs today, maps and remap
+		double tfull = time_ms([&]()
+		{
+			build_warp_maps(p, maps);
+			warp_frame(src, dst, maps);
+		}, iterations);
+
+		// the first look after an angle change, then each refinement
+		ProgressiveWarp preview(p);
+		if (!preview.ok())
+			continue;
+		printf("type %d %dx%d: full %8.2f ms, preview", transformtype, p.outputsize.width, p.outputsize.height, tfull);
+		preview.set_angles(p.anglex + 1, p.angley);
+		while (!preview.done())
+		{
+			if (preview.step(src, 1e9, 0))
+				printf(" 1/%d %7.2f ms", preview.scale(), preview.render_ms());
+		}
+		printf("\n");
+	}
+}
+
+static void bench_raster(int N, const std::string &mapfile, int iterations)
+{
+	Size srcsize(N, N), dstsize(N, N * 9 / 16);
+	WarpMesh mesh;
+	if (!read_mesh_file(mapfile, mesh))
+	{
+		printf("Could not read map file %s\n", mapfile.c_str());
+		return;
+	}
+	Mat gx, gy, gg, rx, ry, rg;
+	double tgrid = time_ms([&]() { warped_from_fisheye_map(mesh, srcsize, dstsize, gx, gy, gg); }, iterations);
+	double traster = time_ms([&]() { rasterise_mesh_map(mesh, srcsize, dstsize, rx, ry, rg); }, iterations);
+
+	// triangles and bilinear cells interpolate differently inside a cell,
+	// compare where both have a source
+	Mat valid = (gx > -1) & (rx > -1);
+	Mat coverage = (gx > -1) ^ (rx > -1);
+	printf("%dx%d mesh %dx%d%s: grid lookup %8.2f ms, raster %8.2f ms, max co-ord diff %.3f px, %d px differ in coverage\n",
+		dstsize.width, dstsize.height, mesh.nx, mesh.ny, mesh_is_regular(mesh, dstsize) ? " (regular)" : "",
+		tgrid, traster, std::max(norm(gx, rx, NORM_INF, valid), norm(gy, ry, NORM_INF, valid)),
+		countNonZero(coverage));
+}
+
+int main(int argc,char *argv[])
+{
+	if (argc < 2)
+	{
+		printf("usage: %s <bench|fused|gain|mesh|raster|stream|crop|planar|i420|mip|profiles|refine|warp|batch|yuv|tune|codecs> ...\n", argv[0]);
+		return 1;
+	}
+	std::string mode = argv[1];
+	if (mode == "warp" || mode == "batch" || mode == "yuv")
+		return warp_video(argc, argv);
+	if (mode == "tune")
+		return tune_angles(argc, argv);
+	if (mode == "codecs")
+		return list_codecs(argc, argv);
+
+	std::string mapfile = argc > 2 ? argv[2] : "EP_xyuv_1920.map";
+	std::vector<int> sizes;
+	if (argc > 3)
+		sizes.push_back(atoi(argv[3]));
+	else
+	{
+		if (mode == "mip")
+		{
+			// the 4x supersampled reference gets big
+			sizes.push_back(1024);
+			sizes.push_back(2048);
+		}
+		else if (mode == "planar" || mode == "profiles")
+		{
+			// 1080p and 4K UHD outputs
+			sizes.push_back(1920);
+			sizes.push_back(3840);
+		}
+		else
+		{
+			if (mode == "raster")
+				sizes.push_back(1920);
+			sizes.push_back(4096);
+			sizes.push_back(8192);
+		}
+	}
+
+	printf("Using %d threads\n", getNumThreads());
+	for (size_t k = 0; k < sizes.size(); k++)
+	{
+		if (mode == "bench")
+			bench_tiled(sizes[k], mapfile, 5);
+		else if (mode == "fused")
+			bench_fused(sizes[k], mapfile, 5);
+		else if (mode == "gain")
+			bench_gain(sizes[k], mapfile, 5);
+		else if (mode == "mesh")
+			bench_mesh(sizes[k], mapfile, 5);
+		else if (mode == "raster")
+			bench_raster(sizes[k], mapfile, 5);
+		else if (mode == "stream")
+			bench_stream(sizes[k], mapfile, 5);
+		else if (mode == "crop")
+			bench_crop(sizes[k], mapfile, 5);
+		else if (mode == "planar")
+			bench_planar(sizes[k], mapfile, 5);
+		else if (mode == "i420")
+			bench_i420(sizes[k], mapfile, 5);
+		else if (mode == "mip")
+			bench_mip(sizes[k], mapfile, 5);
+		else if (mode == "profiles")
+			bench_profiles(sizes[k], mapfile, 5);
+		else if (mode == "refine")
+			bench_refine(sizes[k], mapfile, 5);
+		else
+		{
+			printf("Unknown mode %s\n", mode.c_str());
+			return 1;
+		}
+	}
+
+	return 0;
+
+} // end main
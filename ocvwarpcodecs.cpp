@@ -0,0 +1,116 @@
+/*
+ * Codec capability probe for OCVWarp. See ocvwarpcodecs.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <mutex>
+
+#include <opencv2/opencv.hpp>
+
+#include "ocvwarpcodecs.h"
+
+using namespace cv;
+
+std::string codec_build_key()
+{
+	// FNV-1a, only to tell builds apart
+	const std::string &info = getBuildInformation();
+	unsigned long long h = 14695981039346656037ULL;
+	for (size_t k = 0; k < info.size(); k++)
+	{
+		h ^= (unsigned char)info[k];
+		h *= 1099511628211ULL;
+	}
+	char key[64];
+	snprintf(key, sizeof(key), "%s-%016llx", CV_VERSION, h);
+	return key;
+}
+
+std::string codec_cache_path()
+{
+	const char *path = getenv("OCVWARP_CODEC_CACHE");
+	if (path && *path)
+		return path;
+	const char *home = getenv("HOME");
+	if (!home)
+		home = getenv("USERPROFILE");
+	return home ? std::string(home) + "/.ocvwarp-codecs.txt" : ".ocvwarp-codecs.txt";
+}
+
+std::string fourcc_string(int fourcc)
+{
+	std::string s;
+	for (int k = 0; k < 4; k++)
+	{
+		char c = (char)((fourcc >> (8 * k)) & 255);
+		s += (c >= 32 && c < 127) ? c : '?';
+	}
+	return s;
+}
+
+// writes a few frames of a small clip and reads the first one back
+static bool probe_codec(const std::string &fourcc, const std::string &ext)
+{
+	const std::string name = codec_cache_path() + ".probe" + ext;
+	bool ok = false;
+	{
+		VideoWriter writer;
+		if (writer.open(name, VideoWriter::fourcc(fourcc[0], fourcc[1], fourcc[2], fourcc[3]),
+			25, Size(64, 64), true))
+		{
+			Mat frame(64, 64, CV_8UC3, Scalar(0, 128, 255));
+			for (int k = 0; k < 3; k++)
+				writer.write(frame);
+			writer.release();
+
+			VideoCapture cap(name);
+			Mat back;
+			ok = cap.isOpened() && cap.read(back) && back.size() == frame.size();
+		}
+	}
+	remove(name.c_str());
+	return ok;
+}
+
+bool codec_available(const std::string &fourcc, const std::string &container, bool *cached)
+{
+	// the segment workers may ask at the same time, only one probes
+	static std::mutex m;
+	std::lock_guard<std::mutex> lock(m);
+
+	std::string ext = container.substr(container.find_last_of('.') == std::string::npos
+		? container.size() : container.find_last_of('.'));
+	if (fourcc.size() != 4 || ext.empty())
+		return false;
+	const std::string build = codec_build_key();
+	const std::string path = codec_cache_path();
+
+	// lines of build key, fourcc, extension, 1 or 0
+	std::ifstream in(path.c_str());
+	std::string b, f, e;
+	int ok;
+	while (in >> b >> f >> e >> ok)
+	{
+		if (b == build && f == fourcc && e == ext)
+		{
+			if (cached)
+				*cached = true;
+			return ok != 0;
+		}
+	}
+	in.close();
+
+	bool available = probe_codec(fourcc, ext);
+	FILE *out = fopen(path.c_str(), "a");
+	if (out)
+	{
+		fprintf(out, "%s %s %s %d\n", build.c_str(), fourcc.c_str(), ext.c_str(), available ? 1 : 0);
+		fclose(out);
+	}
+	if (cached)
+		*cached = false;
+	return available;
+}
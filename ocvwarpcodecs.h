@@ -0,0 +1,30 @@
+#ifndef OCVWARPCODECS_H
+#define OCVWARPCODECS_H
+
+/*
+ * Codec capability probe for OCVWarp - which fourcc / container pairs this
+ * OpenCV build can actually write, instead of the static list in
+ * build/fourcc.txt. Each pair is tried once, by writing and reading back a
+ * tiny clip, and the result is kept in a cache file keyed by the OpenCV
+ * build, so that a bad fourcc fails at startup rather than after a long warp.
+ *
+ */
+
+#include <string>
+
+// the OpenCV version and a hash of its build information, which names the
+// FFmpeg (or other video I/O) libraries and their versions
+std::string codec_build_key();
+
+// $OCVWARP_CODEC_CACHE, else .ocvwarp-codecs.txt in the home directory
+std::string codec_cache_path();
+
+// 'XVID' and so on from a CAP_PROP_FOURCC value
+std::string fourcc_string(int fourcc);
+
+// true if fourcc can be written to a file with the extension of container
+// (like ".mp4" or "out.mp4"), probed the first time for this build and then
+// taken from the cache. cached, if given, tells which it was.
+bool codec_available(const std::string &fourcc, const std::string &container, bool *cached = 0);
+
+#endif
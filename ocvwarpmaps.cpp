@@ -0,0 +1,598 @@
+/*
+ * Remap table generation for the OCVWarp transform types.
+ * See ocvwarpmaps.h and build/transformtype.txt
+ *
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <fstream>
+#include <vector>
+#include <mutex>
+#include <limits.h>
+
+#include "ocvwarpmaps.h"
+
+using namespace cv;
+
+// rotation taking fisheye (camera) co-ords to equirect (world) co-ords,
+// angley tilts about x, then anglex pans about z
+static Matx33f camera_to_world(float anglex, float angley)
+{
+	float ax = anglex * (float)CV_PI / 180.0f;
+	float ay = angley * (float)CV_PI / 180.0f;
+	Matx33f Rx(1, 0, 0,
+		0, cosf(ay), -sinf(ay),
+		0, sinf(ay), cosf(ay));
+	Matx33f Rz(cosf(ax), -sinf(ax), 0,
+		sinf(ax), cosf(ax), 0,
+		0, 0, 1);
+	return Rz * Rx;
+}
+
+static inline float clampf(float v, float lo, float hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// the output rows a map covers, Range::all() is the whole frame
+static inline Range output_rows(const Range &rows, Size dstsize)
+{
+	if (rows == Range::all())
+		return Range(0, dstsize.height);
+	return Range(std::max(rows.start, 0), std::min(rows.end, dstsize.height));
+}
+
+bool read_mesh_file(const std::string &path, WarpMesh &mesh)
+{
+	std::ifstream infile(path.c_str());
+	if (!infile.is_open())
+		return false;
+
+	infile >> mesh.meshtype;
+	infile >> mesh.nx >> mesh.ny;
+	if (!infile || mesh.nx < 2 || mesh.ny < 2)
+		return false;
+
+	mesh.xy.create(mesh.ny, mesh.nx, CV_32FC2);
+	mesh.uv.create(mesh.ny, mesh.nx, CV_32FC2);
+	mesh.intensity.create(mesh.ny, mesh.nx, CV_32F);
+	for (int j = 0; j < mesh.ny; j++)
+	{
+		for (int i = 0; i < mesh.nx; i++)
+		{
+			float x, y, u, v, in;
+			infile >> x >> y >> u >> v >> in;
+			mesh.xy.at<Vec2f>(j, i) = Vec2f(x, y);
+			mesh.uv.at<Vec2f>(j, i) = Vec2f(u, v);
+			mesh.intensity.at<float>(j, i) = in;
+		}
+	}
+	return !infile.fail();
+}
+
+// equirect pixel co-ords seen by the fisheye at normalized X, Y (unit circle),
+// false outside the fisheye circle
+static inline bool equirect_point(const Matx33f &R, float halfaperture, float W, float H,
+	float X, float Y, float &sx, float &sy)
+{
+	float Rad = sqrtf(X * X + Y * Y);
+	if (Rad > 1.0f)
+		return false;
+	float phi = Rad * halfaperture;
+	float theta = atan2f(Y, X);
+	Vec3f P(sinf(phi) * cosf(theta), sinf(phi) * sinf(theta), cosf(phi));
+	Vec3f Q = R * P;
+	float longi = atan2f(Q[1], Q[0]);
+	float lat = asinf(clampf(Q[2], -1.0f, 1.0f));
+	sx = clampf((longi + (float)CV_PI) / (2.0f * (float)CV_PI) * W - 0.5f, 0, W - 1);
+	sy = clampf(((float)CV_PI / 2 - lat) / (float)CV_PI * H - 0.5f, 0, H - 1);
+	return true;
+}
+
+void fisheye_from_equirect_map(Size srcsize, Size dstsize, float aperturedeg,
+	float anglex, float angley, Mat &map_x, Mat &map_y, Range rows)
+{
+	const Range out = output_rows(rows, dstsize);
+	map_x.create(out.size(), dstsize.width, CV_32F);
+	map_y.create(out.size(), dstsize.width, CV_32F);
+	const Matx33f R = camera_to_world(anglex, angley);
+	const float halfaperture = aperturedeg * (float)CV_PI / 360.0f;
+	const float W = (float)srcsize.width, H = (float)srcsize.height;
+
+	parallel_for_(Range(0, out.size()), [&](const Range &r)
+	{
+		for (int j = r.start; j < r.end; j++)
+		{
+			float *mx = map_x.ptr<float>(j);
+			float *my = map_y.ptr<float>(j);
+			float Y = 1.0f - 2.0f * (out.start + j + 0.5f) / dstsize.height;
+			for (int i = 0; i < dstsize.width; i++)
+			{
+				float X = 2.0f * (i + 0.5f) / dstsize.width - 1.0f;
+				if (!equirect_point(R, halfaperture, W, H, X, Y, mx[i], my[i]))
+					mx[i] = my[i] = OCVW_NOSOURCE;
+			}
+		}
+	});
+}
+
+void fuse_fisheye_from_equirect_map(Size srcsize, Size midsize, float aperturedeg,
+	float anglex, float angley, Mat &map_x, Mat &map_y)
+{
+	const Matx33f R = camera_to_world(anglex, angley);
+	const float halfaperture = aperturedeg * (float)CV_PI / 360.0f;
+	const float W = (float)srcsize.width, H = (float)srcsize.height;
+
+	parallel_for_(Range(0, map_x.rows), [&](const Range &r)
+	{
+		for (int j = r.start; j < r.end; j++)
+		{
+			float *mx = map_x.ptr<float>(j);
+			float *my = map_y.ptr<float>(j);
+			for (int i = 0; i < map_x.cols; i++)
+			{
+				if (mx[i] < -1 || my[i] < -1)
+					continue;
+				// fisheye pixel co-ords back to the normalized fisheye
+				float X = 2.0f * (mx[i] + 0.5f) / midsize.width - 1.0f;
+				float Y = 1.0f - 2.0f * (my[i] + 0.5f) / midsize.height;
+				if (!equirect_point(R, halfaperture, W, H, X, Y, mx[i], my[i]))
+					mx[i] = my[i] = OCVW_NOSOURCE;
+			}
+		}
+	});
+}
+
+void equirect_from_fisheye_map(Size srcsize, Size dstsize, float aperturedeg,
+	float anglex, float angley, Mat &map_x, Mat &map_y, Range rows)
+{
+	const Range out = output_rows(rows, dstsize);
+	map_x.create(out.size(), dstsize.width, CV_32F);
+	map_y.create(out.size(), dstsize.width, CV_32F);
+	// inverse rotation is the transpose
+	const Matx33f Rt = camera_to_world(anglex, angley).t();
+	const float halfaperture = aperturedeg * (float)CV_PI / 360.0f;
+	const float w = (float)srcsize.width, h = (float)srcsize.height;
+
+	parallel_for_(Range(0, out.size()), [&](const Range &r)
+	{
+		for (int j = r.start; j < r.end; j++)
+		{
+			float *mx = map_x.ptr<float>(j);
+			float *my = map_y.ptr<float>(j);
+			float lat = (float)CV_PI / 2 - (out.start + j + 0.5f) / dstsize.height * (float)CV_PI;
+			for (int i = 0; i < dstsize.width; i++)
+			{
+				float longi = (i + 0.5f) / dstsize.width * 2.0f * (float)CV_PI - (float)CV_PI;
+				Vec3f P(cosf(lat) * cosf(longi), cosf(lat) * sinf(longi), sinf(lat));
+				Vec3f Q = Rt * P;
+				float phi = acosf(clampf(Q[2], -1.0f, 1.0f));
+				float Rad = phi / halfaperture;
+				if (Rad > 1.0f)
+				{
+					mx[i] = my[i] = OCVW_NOSOURCE;
+					continue;
+				}
+				float theta = atan2f(Q[1], Q[0]);
+				mx[i] = (Rad * cosf(theta) + 1.0f) / 2.0f * w - 0.5f;
+				my[i] = (1.0f - Rad * sinf(theta)) / 2.0f * h - 0.5f;
+			}
+		}
+	});
+}
+
+// Expands the mesh to one entry per output pixel, treating the mesh nodes
+// as a regular grid spanning the whole output frame, like EP_xyuv_1920.map
+void warped_from_fisheye_map(const WarpMesh &mesh, Size srcsize, Size dstsize,
+	Mat &map_x, Mat &map_y, Mat &gain, Range rows)
+{
+	const Range out = output_rows(rows, dstsize);
+	map_x.create(out.size(), dstsize.width, CV_32F);
+	map_y.create(out.size(), dstsize.width, CV_32F);
+	gain.create(out.size(), dstsize.width, CV_32F);
+	const float w = (float)srcsize.width, h = (float)srcsize.height;
+	const float sx = dstsize.width > 1 ? (float)(mesh.nx - 1) / (dstsize.width - 1) : 0;
+	const float sy = dstsize.height > 1 ? (float)(mesh.ny - 1) / (dstsize.height - 1) : 0;
+
+	parallel_for_(Range(0, out.size()), [&](const Range &r)
+	{
+		for (int j = r.start; j < r.end; j++)
+		{
+			float *mx = map_x.ptr<float>(j);
+			float *my = map_y.ptr<float>(j);
+			float *g = gain.ptr<float>(j);
+			// output row 0 is the top, mesh row 0 is the bottom
+			float gy = (mesh.ny - 1) - (out.start + j) * sy;
+			int y0 = std::min((int)gy, mesh.ny - 2);
+			float fy = gy - y0;
+			const Vec2f *uv0 = mesh.uv.ptr<Vec2f>(y0);
+			const Vec2f *uv1 = mesh.uv.ptr<Vec2f>(y0 + 1);
+			const float *in0 = mesh.intensity.ptr<float>(y0);
+			const float *in1 = mesh.intensity.ptr<float>(y0 + 1);
+			for (int i = 0; i < dstsize.width; i++)
+			{
+				float gx = i * sx;
+				int x0 = std::min((int)gx, mesh.nx - 2);
+				float fx = gx - x0;
+				if (in0[x0] < 0 || in0[x0 + 1] < 0 || in1[x0] < 0 || in1[x0 + 1] < 0)
+				{
+					mx[i] = my[i] = OCVW_NOSOURCE;
+					g[i] = 0;
+					continue;
+				}
+				float w00 = (1 - fx) * (1 - fy), w01 = fx * (1 - fy);
+				float w10 = (1 - fx) * fy, w11 = fx * fy;
+				Vec2f uv = uv0[x0] * w00 + uv0[x0 + 1] * w01 + uv1[x0] * w10 + uv1[x0 + 1] * w11;
+				g[i] = in0[x0] * w00 + in0[x0 + 1] * w01 + in1[x0] * w10 + in1[x0 + 1] * w11;
+				mx[i] = uv[0] * w - 0.5f;
+				my[i] = (1.0f - uv[1]) * h - 0.5f;
+			}
+		}
+	});
+}
+
+// node position in output pixels, x spans [-aspect, aspect] and y [-1, 1] like
+// Paul Bourke's warp meshes, so the corner nodes land on the corner pixels
+static inline Point2f mesh_node_pixel(const Vec2f &xy, Size dstsize)
+{
+	float aspect = (float)dstsize.width / dstsize.height;
+	return Point2f((xy[0] / aspect + 1.0f) / 2.0f * (dstsize.width - 1),
+		(1.0f - xy[1]) / 2.0f * (dstsize.height - 1));
+}
+
+bool mesh_is_regular(const WarpMesh &mesh, Size dstsize)
+{
+	const float tol = 0.25f;	// pixels
+	for (int j = 0; j < mesh.ny; j++)
+	{
+		for (int i = 0; i < mesh.nx; i++)
+		{
+			Point2f q = mesh_node_pixel(mesh.xy.at<Vec2f>(j, i), dstsize);
+			float gx = i * (dstsize.width - 1) / (float)(mesh.nx - 1);
+			float gy = (mesh.ny - 1 - j) * (dstsize.height - 1) / (float)(mesh.ny - 1);
+			if (fabsf(q.x - gx) > tol || fabsf(q.y - gy) > tol)
+				return false;
+		}
+	}
+	return true;
+}
+
+// one triangle of the mesh with its attributes as planes a(x,y) = a0 + dx*x + dy*y
+struct MeshTriangle
+{
+	float ymin, ymax;
+	Point2f p[3];
+	float a0[3], dx[3], dy[3];	// source x, source y, gain
+};
+
+static bool setup_triangle(const Point2f *p, const float attr[3][3], MeshTriangle &t)
+{
+	float det = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+	if (fabsf(det) < 1e-6f)
+		return false;
+	for (int k = 0; k < 3; k++)
+	{
+		t.p[k] = p[k];
+		float d1 = attr[1][k] - attr[0][k], d2 = attr[2][k] - attr[0][k];
+		t.dx[k] = (d1 * (p[2].y - p[0].y) - d2 * (p[1].y - p[0].y)) / det;
+		t.dy[k] = (d2 * (p[1].x - p[0].x) - d1 * (p[2].x - p[0].x)) / det;
+		t.a0[k] = attr[0][k] - t.dx[k] * p[0].x - t.dy[k] * p[0].y;
+	}
+	t.ymin = std::min(p[0].y, std::min(p[1].y, p[2].y));
+	t.ymax = std::max(p[0].y, std::max(p[1].y, p[2].y));
+	return true;
+}
+
+void rasterise_mesh_map(const WarpMesh &mesh, Size srcsize, Size dstsize,
+	Mat &map_x, Mat &map_y, Mat &gain, Range rows)
+{
+	const Range out = output_rows(rows, dstsize);
+	map_x.create(out.size(), dstsize.width, CV_32F);
+	map_y.create(out.size(), dstsize.width, CV_32F);
+	gain.create(out.size(), dstsize.width, CV_32F);
+	map_x.setTo(Scalar::all(OCVW_NOSOURCE));
+	map_y.setTo(Scalar::all(OCVW_NOSOURCE));
+	gain.setTo(Scalar::all(0));
+
+	std::vector<MeshTriangle> tris;
+	tris.reserve(2 * (mesh.nx - 1) * (mesh.ny - 1));
+	for (int j = 0; j < mesh.ny - 1; j++)
+	{
+		for (int i = 0; i < mesh.nx - 1; i++)
+		{
+			const int ci[4] = { i, i + 1, i, i + 1 }, cj[4] = { j, j, j + 1, j + 1 };
+			Point2f q[4];
+			float attr[4][3];
+			bool used = true;
+			for (int c = 0; c < 4; c++)
+			{
+				const Vec2f &uv = mesh.uv.at<Vec2f>(cj[c], ci[c]);
+				attr[c][2] = mesh.intensity.at<float>(cj[c], ci[c]);
+				used = used && attr[c][2] >= 0;
+				q[c] = mesh_node_pixel(mesh.xy.at<Vec2f>(cj[c], ci[c]), dstsize);
+				attr[c][0] = uv[0] * srcsize.width - 0.5f;
+				attr[c][1] = (1.0f - uv[1]) * srcsize.height - 0.5f;
+			}
+			if (!used)
+				continue;
+			// quad 0 1 3 2 as triangles 0 1 3 and 0 3 2
+			const int tri[2][3] = { { 0, 1, 3 }, { 0, 3, 2 } };
+			for (int k = 0; k < 2; k++)
+			{
+				Point2f p[3];
+				float a[3][3];
+				for (int c = 0; c < 3; c++)
+				{
+					p[c] = q[tri[k][c]];
+					for (int m = 0; m < 3; m++)
+						a[c][m] = attr[tri[k][c]][m];
+				}
+				MeshTriangle t;
+				if (setup_triangle(p, a, t))
+					tris.push_back(t);
+			}
+		}
+	}
+
+	// each band of rows is written by one thread only
+	const int bandrows = 32;
+	const int nbands = (out.size() + bandrows - 1) / bandrows;
+	parallel_for_(Range(0, nbands), [&](const Range &r)
+	{
+		for (int b = r.start; b < r.end; b++)
+		{
+			const int y0 = out.start + b * bandrows, y1 = std::min(y0 + bandrows, out.end);
+			for (size_t n = 0; n < tris.size(); n++)
+			{
+				const MeshTriangle &t = tris[n];
+				if (t.ymax < y0 || t.ymin > y1 - 1)
+					continue;
+				const int ya = std::max(y0, (int)ceilf(t.ymin - 1e-4f));
+				const int yb = std::min(y1 - 1, (int)floorf(t.ymax + 1e-4f));
+				for (int y = ya; y <= yb; y++)
+				{
+					// span of the row inside the triangle
+					float xl = FLT_MAX, xr = -FLT_MAX;
+					for (int e = 0; e < 3; e++)
+					{
+						const Point2f &a = t.p[e], &c = t.p[(e + 1) % 3];
+						if ((y < a.y && y < c.y) || (y > a.y && y > c.y) || a.y == c.y)
+							continue;
+						float x = a.x + (c.x - a.x) * (y - a.y) / (c.y - a.y);
+						xl = std::min(xl, x);
+						xr = std::max(xr, x);
+					}
+					if (xl > xr)
+						continue;
+					const int i0 = std::max(0, (int)ceilf(xl - 1e-4f));
+					const int i1 = std::min(dstsize.width - 1, (int)floorf(xr + 1e-4f));
+					float *mx = map_x.ptr<float>(y - out.start);
+					float *my = map_y.ptr<float>(y - out.start);
+					float *g = gain.ptr<float>(y - out.start);
+					const float bx = t.a0[0] + t.dy[0] * y, by = t.a0[1] + t.dy[1] * y, bg = t.a0[2] + t.dy[2] * y;
+					const float dxx = t.dx[0], dxy = t.dx[1], dxg = t.dx[2];
+					// affine along the row, no dependency between pixels, vectorises
+					for (int i = i0; i <= i1; i++)
+					{
+						mx[i] = bx + dxx * i;
+						my[i] = by + dxy * i;
+						g[i] = bg + dxg * i;
+					}
+				}
+			}
+		}
+	});
+}
+
+// regular grids are a direct lookup, anything else is scan converted
+static void mesh_map(const WarpMesh &mesh, Size srcsize, Size dstsize, Mat &map_x, Mat &map_y, Mat &gain,
+	Range rows = Range::all())
+{
+	if (mesh_is_regular(mesh, dstsize))
+		warped_from_fisheye_map(mesh, srcsize, dstsize, map_x, map_y, gain, rows);
+	else
+		rasterise_mesh_map(mesh, srcsize, dstsize, map_x, map_y, gain, rows);
+}
+
+Rect source_box(const Mat &map_x, const Mat &map_y, Rect roi, Size srcsize)
+{
+	float minx = FLT_MAX, miny = FLT_MAX, maxx = -FLT_MAX, maxy = -FLT_MAX;
+	for (int j = roi.y; j < roi.y + roi.height; j++)
+	{
+		const float *mx = map_x.ptr<float>(j);
+		const float *my = map_y.ptr<float>(j);
+		for (int i = roi.x; i < roi.x + roi.width; i++)
+		{
+			if (mx[i] < -1 || my[i] < -1 || mx[i] > srcsize.width || my[i] > srcsize.height)
+				continue;
+			minx = std::min(minx, mx[i]);
+			maxx = std::max(maxx, mx[i]);
+			miny = std::min(miny, my[i]);
+			maxy = std::max(maxy, my[i]);
+		}
+	}
+	if (minx > maxx)
+		return Rect();
+	Rect box((int)floorf(minx) - 2, (int)floorf(miny) - 2,
+		(int)ceilf(maxx) - (int)floorf(minx) + 5, (int)ceilf(maxy) - (int)floorf(miny) + 5);
+	return box & Rect(Point(0, 0), srcsize);
+}
+
+void source_regions(const Mat &map_x, const Mat &map_y, Size srcsize, int bandrows,
+	Rect &box, std::vector<Rect> &bands)
+{
+	const int nbands = (srcsize.height + bandrows - 1) / bandrows;
+	std::vector<int> minx(nbands, INT_MAX), maxx(nbands, INT_MIN);
+	std::mutex m;
+
+	// column extent of the referenced pixels in each band of source rows,
+	// per thread first, then merged
+	parallel_for_(Range(0, map_x.rows), [&](const Range &r)
+	{
+		std::vector<int> lo(nbands, INT_MAX), hi(nbands, INT_MIN);
+		for (int j = r.start; j < r.end; j++)
+		{
+			const float *mx = map_x.ptr<float>(j);
+			const float *my = map_y.ptr<float>(j);
+			for (int i = 0; i < map_x.cols; i++)
+			{
+				if (mx[i] < -1 || my[i] < -1 || mx[i] > srcsize.width || my[i] > srcsize.height)
+					continue;
+				const int x = (int)floorf(mx[i]), y = (int)floorf(my[i]);
+				// the taps of y reach the rows y - 1 .. y + 2, which may be in the next band
+				const int b0 = std::max(y - 2, 0) / bandrows;
+				const int b1 = std::min(y + 2, srcsize.height - 1) / bandrows;
+				for (int b = b0; b <= b1; b++)
+				{
+					lo[b] = std::min(lo[b], x);
+					hi[b] = std::max(hi[b], x);
+				}
+			}
+		}
+		std::lock_guard<std::mutex> lock(m);
+		for (int b = 0; b < nbands; b++)
+		{
+			minx[b] = std::min(minx[b], lo[b]);
+			maxx[b] = std::max(maxx[b], hi[b]);
+		}
+	});
+
+	box = Rect();
+	bands.assign(nbands, Rect());
+	for (int b = 0; b < nbands; b++)
+	{
+		if (minx[b] > maxx[b])
+			continue;
+		bands[b] = Rect(minx[b] - 2, b * bandrows, maxx[b] - minx[b] + 5, bandrows) & Rect(Point(0, 0), srcsize);
+		box = box.empty() ? bands[b] : (box | bands[b]);
+	}
+}
+
+bool build_band_maps(const WarpParams &p, const WarpMesh &mesh, Range rows,
+	Mat &map_x, Mat &map_y, Mat &gain)
+{
+	gain.release();
+	switch (p.transformtype)
+	{
+	case 0:
+		fisheye_from_equirect_map(p.inputsize, p.outputsize, 360, p.anglex, p.angley, map_x, map_y, rows);
+		break;
+	case 1:
+		fisheye_from_equirect_map(p.inputsize, p.outputsize, 180, p.anglex, p.angley, map_x, map_y, rows);
+		break;
+	case 2:
+		equirect_from_fisheye_map(p.inputsize, p.outputsize, 360, p.anglex, p.angley, map_x, map_y, rows);
+		break;
+	case 3:
+		equirect_from_fisheye_map(p.inputsize, p.outputsize, 180, p.anglex, p.angley, map_x, map_y, rows);
+		break;
+	case 4:
+		mesh_map(mesh, p.inputsize, p.outputsize, map_x, map_y, gain, rows);
+		break;
+	case 5:
+	{
+		// the mesh gives fisheye co-ords for each output pixel, which go
+		// straight to the equirect - one remap, no intermediate frame
+		const Size midsize(p.inputsize.height, p.inputsize.height);
+		mesh_map(mesh, midsize, p.outputsize, map_x, map_y, gain, rows);
+		fuse_fisheye_from_equirect_map(p.inputsize, midsize, 180, p.anglex, p.angley, map_x, map_y);
+		break;
+	}
+	default:
+		fprintf(stderr, "Unknown transformtype %d\n", p.transformtype);
+		return false;
+	}
+	return true;
+}
+
+bool build_warp_maps(const WarpParams &p, WarpMaps &maps, bool fused)
+{
+	maps.transformtype = p.transformtype;
+	maps.srcsize = p.inputsize;
+	maps.dstsize = p.outputsize;
+	maps.gain.release();
+	maps.map2_x.release();
+	maps.map2_y.release();
+	maps.midsize = Size();
+
+	WarpMesh mesh;
+	if (p.transformtype == 4 || p.transformtype == 5)
+	{
+		if (!read_mesh_file(p.mapfile, mesh))
+		{
+			fprintf(stderr, "Could not read map file %s\n", p.mapfile.c_str());
+			return false;
+		}
+	}
+
+	if (p.transformtype == 5 && !fused)
+	{
+		// intermediate fisheye keeps the vertical resolution of the equirect
+		maps.midsize = Size(p.inputsize.height, p.inputsize.height);
+		fisheye_from_equirect_map(p.inputsize, maps.midsize, 180, p.anglex, p.angley, maps.map_x, maps.map_y);
+		mesh_map(mesh, maps.midsize, p.outputsize, maps.map2_x, maps.map2_y, maps.gain);
+	}
+	else if (!build_band_maps(p, mesh, Range::all(), maps.map_x, maps.map_y, maps.gain))
+		return false;
+	maps.bandrows = 64;
+	source_regions(maps.map_x, maps.map_y, maps.srcsize, maps.bandrows, maps.srcbox, maps.srcbands);
+	return true;
+}
+
+bool edge_coverage(const WarpParams &p, int factor, Mat &coverage, Mat *centroid)
+{
+	WarpMesh mesh;
+	if ((p.transformtype == 4 || p.transformtype == 5) && !read_mesh_file(p.mapfile, mesh))
+	{
+		fprintf(stderr, "Could not read map file %s\n", p.mapfile.c_str());
+		return false;
+	}
+	WarpParams big = p;
+	big.outputsize = Size(p.outputsize.width * factor, p.outputsize.height * factor);
+	coverage.create(p.outputsize, CV_32F);
+	if (centroid)
+		centroid->create(p.outputsize, CV_32FC2);
+
+	// full size maps at factor times the output would not fit for 8K
+	const int bandrows = 16;
+	Mat map_x, map_y, gain, valid, band, sums[2], means[2];
+	for (int y0 = 0; y0 < p.outputsize.height; y0 += bandrows)
+	{
+		const int y1 = std::min(y0 + bandrows, p.outputsize.height);
+		if (!build_band_maps(big, mesh, Range(y0 * factor, y1 * factor), map_x, map_y, gain))
+			return false;
+		valid = (map_x >= -1) & (map_y >= -1);
+		valid.convertTo(band, CV_32F, 1.0 / 255);
+		const Size bandsize(p.outputsize.width, y1 - y0);
+		resize(band, coverage.rowRange(y0, y1), bandsize, 0, 0, INTER_AREA);
+		if (!centroid)
+			continue;
+		// the means of the co-ords with the uncovered subsamples as 0, over the coverage
+		const Mat cov = coverage.rowRange(y0, y1);
+		for (int c = 0; c < 2; c++)
+		{
+			sums[c] = Mat::zeros(map_x.size(), CV_32F);
+			(c == 0 ? map_x : map_y).copyTo(sums[c], valid);
+			resize(sums[c], means[c], bandsize, 0, 0, INTER_AREA);
+			divide(means[c], cov, means[c]);
+			means[c].setTo(-1, cov == 0);
+		}
+		merge(means, 2, centroid->rowRange(y0, y1));
+	}
+	return true;
+}
+
+void warp_frame(const Mat &src, Mat &dst, const WarpMaps &maps, int interpolation)
+{
+	if (maps.map2_x.empty())
+	{
+		remap(src, dst, maps.map_x, maps.map_y, interpolation, BORDER_CONSTANT, Scalar(0, 0, 0));
+		return;
+	}
+	Mat mid;
+	remap(src, mid, maps.map_x, maps.map_y, interpolation, BORDER_CONSTANT, Scalar(0, 0, 0));
+	remap(mid, dst, maps.map2_x, maps.map2_y, interpolation, BORDER_CONSTANT, Scalar(0, 0, 0));
+}
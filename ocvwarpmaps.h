@@ -0,0 +1,120 @@
+#ifndef OCVWARPMAPS_H
+#define OCVWARPMAPS_H
+
+/*
+ * Remap table generation for the OCVWarp transform types,
+ * see build/transformtype.txt
+ *
+ * 0  EquirectTo360Fisheye
+ * 1  EquirectTo180Fisheye
+ * 2  360FisheyeToEquirect
+ * 3  180FisheyeToEquirect
+ * 4  180Fisheye (fulldome) to warped, using a mesh file like EP_xyuv_1920.map
+ * 5  Equirect to warped - equivalent to doing 1 followed by 4
+ *
+ * Conventions follow the octave/ scripts - the fisheye looks up at the
+ * zenith (+z), longitude is measured from +x, AngleY tilts about the x axis
+ * and AngleX pans about the z axis.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// map value used for output pixels which have no source,
+// far enough outside the frame that bilinear / bicubic taps see only border
+#define OCVW_NOSOURCE -16.0f
+
+struct WarpParams
+{
+	int transformtype;
+	float anglex;		// degrees
+	float angley;		// degrees
+	cv::Size inputsize;
+	cv::Size outputsize;
+	std::string mapfile;	// used for transformtype 4 & 5
+};
+
+// Paul Bourke style warp mesh, as in EP_xyuv_1920.map
+// each node has x y u v i, rows are stored in file order (first row is y=-1, the bottom)
+struct WarpMesh
+{
+	int meshtype;
+	int nx, ny;
+	cv::Mat xy;		// CV_32FC2, ny x nx, output position, x in [-aspect,aspect], y in [-1,1]
+	cv::Mat uv;		// CV_32FC2, ny x nx, fisheye texture co-ords in [0,1], v=0 at the bottom
+	cv::Mat intensity;	// CV_32F, ny x nx, negative means the node is not used
+};
+
+struct WarpMaps
+{
+	int transformtype;
+	cv::Size srcsize;
+	cv::Size dstsize;
+	cv::Mat map_x, map_y;	// CV_32F, dstsize, absolute source pixel co-ords
+	cv::Mat gain;		// CV_32F, dstsize, mesh intensity, only for transformtype 4 & 5
+	// unfused transformtype 5 is done as two remaps - map_x, map_y take the
+	// equirect to an intermediate fisheye of midsize, map2_x, map2_y warp that fisheye
+	cv::Size midsize;
+	cv::Mat map2_x, map2_y;
+	// the part of the source map_x, map_y read, including the interpolation
+	// taps - overall, and for each band of bandrows source rows (empty if
+	// none of that band is read). Nothing outside needs decoding or converting.
+	cv::Rect srcbox;
+	int bandrows;
+	std::vector<cv::Rect> srcbands;
+};
+
+bool read_mesh_file(const std::string &path, WarpMesh &mesh);
+
+// rows limits the maps to a band of output rows, map row 0 is output row rows.start
+void fisheye_from_equirect_map(cv::Size srcsize, cv::Size dstsize, float aperturedeg,
+	float anglex, float angley, cv::Mat &map_x, cv::Mat &map_y, cv::Range rows = cv::Range::all());
+void equirect_from_fisheye_map(cv::Size srcsize, cv::Size dstsize, float aperturedeg,
+	float anglex, float angley, cv::Mat &map_x, cv::Mat &map_y, cv::Range rows = cv::Range::all());
+void warped_from_fisheye_map(const WarpMesh &mesh, cv::Size srcsize, cv::Size dstsize,
+	cv::Mat &map_x, cv::Mat &map_y, cv::Mat &gain, cv::Range rows = cv::Range::all());
+// same as warped_from_fisheye_map, for any mesh - the node x, y positions are
+// used as given, each mesh quad is split into two triangles which are scan
+// converted in parallel row bands with barycentric (affine) interpolation
+void rasterise_mesh_map(const WarpMesh &mesh, cv::Size srcsize, cv::Size dstsize,
+	cv::Mat &map_x, cv::Mat &map_y, cv::Mat &gain, cv::Range rows = cv::Range::all());
+// true if the nodes lie on an evenly spaced grid covering the whole output,
+// build_warp_maps then uses warped_from_fisheye_map, else rasterise_mesh_map
+bool mesh_is_regular(const WarpMesh &mesh, cv::Size dstsize);
+// composes a map into a fisheye of midsize with fisheye_from_equirect_map, in place -
+// the fisheye co-ords in map_x, map_y become equirect co-ords of an srcsize frame
+void fuse_fisheye_from_equirect_map(cv::Size srcsize, cv::Size midsize, float aperturedeg,
+	float anglex, float angley, cv::Mat &map_x, cv::Mat &map_y);
+
+// fills maps for p.transformtype, returns false if the mesh file can't be read.
+// With fused, transformtype 5 is a single equirect to warped lookup,
+// otherwise 1 followed by 4 through an intermediate fisheye
+bool build_warp_maps(const WarpParams &p, WarpMaps &maps, bool fused = true);
+
+// bounding box of the in-frame source co-ords referenced by map_x, map_y within roi,
+// padded by 2 pixels for the interpolation taps and clipped to the source
+cv::Rect source_box(const cv::Mat &map_x, const cv::Mat &map_y, cv::Rect roi, cv::Size srcsize);
+
+// the srcbox and srcbands of WarpMaps for any maps
+void source_regions(const cv::Mat &map_x, const cv::Mat &map_y, cv::Size srcsize, int bandrows,
+	cv::Rect &box, std::vector<cv::Rect> &bands);
+
+// single stage (fused) maps for the output rows in rows only, mesh is the
+// map file already read for transformtype 4 and 5. gain is left empty for 0 - 3
+bool build_band_maps(const WarpParams &p, const WarpMesh &mesh, cv::Range rows,
+	cv::Mat &map_x, cv::Mat &map_y, cv::Mat &gain);
+
+// fraction of factor x factor subsamples of each output pixel which have a
+// source, from maps at factor times the output size, made a band at a time.
+// CV_32F, 1 inside, 0 outside, in between only along the edge of the picture.
+// centroid, if given, is the mean source co-ord of the covered subsamples,
+// CV_32FC2, -1 where there are none.
+bool edge_coverage(const WarpParams &p, int factor, cv::Mat &coverage, cv::Mat *centroid = 0);
+
+// plain cv::remap of one frame using maps, two passes for unfused transformtype 5
+void warp_frame(const cv::Mat &src, cv::Mat &dst, const WarpMaps &maps,
+	int interpolation = cv::INTER_LINEAR);
+
+#endif
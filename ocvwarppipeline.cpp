@@ -0,0 +1,1833 @@
+/*
+ * Frame pipeline for OCVWarp. See ocvwarppipeline.h
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <fstream>
+#include <algorithm>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "ocvwarppipeline.h"
+#include "ocvwarpcodecs.h"
+
+using namespace cv;
+
+// pipes to the ffmpeg child processes, binary on Windows
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#define POPEN_READ "rb"
+#define POPEN_WRITE "wb"
+#else
+#define POPEN_READ "r"
+#define POPEN_WRITE "w"
+#endif
+
+int interpolation_profile(const std::string &name)
+{
+	if (name == "preview")
+		return PROFILE_PREVIEW;
+	if (name == "standard")
+		return PROFILE_STANDARD;
+	if (name == "master")
+		return PROFILE_MASTER;
+	return -1;
+}
+
+const char *profile_name(int profile)
+{
+	static const char *names[] = { "preview", "standard", "master" };
+	return profile >= 0 && profile <= PROFILE_MASTER ? names[profile] : "unknown";
+}
+
+bool read_ocvwarp_ini(const std::string &path, WarpJob &job)
+{
+	std::ifstream infile(path.c_str());
+	if (!infile.is_open())
+		return false;
+
+	// values in file order, every token starting with # is a comment
+	std::vector<std::string> values;
+	std::string token;
+	while (infile >> token)
+	{
+		if (token[0] != '#')
+			values.push_back(token);
+	}
+	if (values.size() < 10)
+		return false;
+
+	job.params.anglex = (float)atof(values[0].c_str());
+	job.anglexincr = (float)atof(values[1].c_str());
+	job.params.angley = (float)atof(values[2].c_str());
+	job.angleyincr = (float)atof(values[3].c_str());
+	job.params.outputsize = Size(atoi(values[4].c_str()), atoi(values[5].c_str()));
+	job.params.transformtype = atoi(values[6].c_str());
+	job.fourcc = values[7];
+	job.params.mapfile = values[8];
+	job.outputfps = atoi(values[9].c_str());
+	job.profile = PROFILE_STANDARD;
+	if (values.size() > 10)
+	{
+		job.profile = interpolation_profile(values[10]);
+		if (job.profile < 0)
+		{
+			fprintf(stderr, "Unknown interpolation profile %s\n", values[10].c_str());
+			return false;
+		}
+	}
+	// not in the ini, set from the command line
+	job.blend = false;
+	job.gamma = 1.0f;
+	job.meshwarp = false;
+	job.planar = false;
+	job.mip = false;
+	job.stream = false;
+	job.compression = -1;
+	job.startframe = 0;
+	job.endframe = -1;
+	job.timing = 0;
+	return true;
+}
+
+static bool open_input(const WarpJob &job, VideoCapture &cap, WarpParams &p)
+{
+	if (!cap.open(job.inputfile))
+	{
+		fprintf(stderr, "Could not open input %s\n", job.inputfile.c_str());
+		return false;
+	}
+	p = job.params;
+	p.inputsize = Size((int)cap.get(CAP_PROP_FRAME_WIDTH), (int)cap.get(CAP_PROP_FRAME_HEIGHT));
+	return true;
+}
+
+// input keyframes as frame indices from ffprobe, in order, empty if ffprobe
+// is not there or gives nothing. Only the packets are read, with their
+// keyframe flags, nothing is decoded.
+static std::vector<long long> probe_keyframes(const std::string &file, double fps)
+{
+	std::vector<long long> keys;
+	std::string cmd = "ffprobe -v error -select_streams v:0 -show_entries packet=pts_time,flags "
+		"-of csv=p=0 \"" + file + "\"";
+	FILE *in = popen(cmd.c_str(), POPEN_READ);
+	if (!in)
+		return keys;
+	std::vector<double> times;
+	double start = -1;
+	char line[256];
+	while (fgets(line, sizeof(line), in))
+	{
+		// pts_time,flags - K_ for a keyframe
+		double t;
+		char flags[32];
+		if (sscanf(line, "%lf,%31s", &t, flags) != 2)
+			continue;
+		if (start < 0 || t < start)
+			start = t;
+		if (strchr(flags, 'K'))
+			times.push_back(t);
+	}
+	pclose(in);
+	// frame 0 is the first pts, which need not be 0
+	for (size_t k = 0; k < times.size(); k++)
+		keys.push_back((long long)((times[k] - start) * fps + 0.5));
+	std::sort(keys.begin(), keys.end());
+	return keys;
+}
+
+// decodes forward to frame from the keyframe before it, which the container
+// index finds without decoding. Without keyframes (no ffprobe), OpenCV's
+// seek, which the FFmpeg backend does the same way.
+static bool seek_frame(VideoCapture &cap, long long frame, const std::vector<long long> &keys)
+{
+	if (frame <= 0)
+		return true;
+	std::vector<long long>::const_iterator k = std::upper_bound(keys.begin(), keys.end(), frame);
+	if (k == keys.begin())
+		return cap.set(CAP_PROP_POS_FRAMES, (double)frame);
+	long long key = *(k - 1);
+	if (key > 0 && !cap.set(CAP_PROP_POS_FRAMES, (double)key))
+		return false;
+	for (long long n = key; n < frame; n++)
+		if (!cap.grab())
+			return false;
+	return true;
+}
+
+// frames to process from the input's startframe, -1 for all to the end
+static long long range_frames(const WarpJob &job)
+{
+	return job.endframe < 0 ? -1 : std::max(job.endframe - job.startframe, 0LL);
+}
+
+// open_input, then seeks to job.startframe
+static bool open_input_at(const WarpJob &job, VideoCapture &cap, WarpParams &p)
+{
+	if (!open_input(job, cap, p))
+		return false;
+	if (job.startframe > 0 && !seek_frame(cap, job.startframe,
+		probe_keyframes(job.inputfile, cap.get(CAP_PROP_FPS))))
+	{
+		fprintf(stderr, "Could not seek to frame %lld of %s\n", job.startframe, job.inputfile.c_str());
+		return false;
+	}
+	return true;
+}
+
+// the job's fourcc, or the input's for NULL - MJPG, which OpenCV always
+// has, if the input is not a video (an intermediate file)
+static int output_fourcc(const WarpJob &job, VideoCapture &cap)
+{
+	if (job.fourcc == "NULL" || job.fourcc.size() != 4)
+		return cap.isOpened() ? (int)cap.get(CAP_PROP_FOURCC) : VideoWriter::fourcc('M', 'J', 'P', 'G');
+	return VideoWriter::fourcc(job.fourcc[0], job.fourcc[1], job.fourcc[2], job.fourcc[3]);
+}
+
+// false, before any frame is warped, if this OpenCV build cannot write the
+// fourcc to the output container, see codec_available
+static bool check_output_codec(const WarpJob &job, VideoCapture &cap)
+{
+	std::string fourcc = fourcc_string(output_fourcc(job, cap));
+	if (codec_available(fourcc, job.outputfile))
+		return true;
+	fprintf(stderr, "This OpenCV build cannot write %s to %s, try another fourcc or container\n",
+		fourcc.c_str(), job.outputfile.c_str());
+	return false;
+}
+
+// infps is the input's frame rate, for Output_fps -1. Image sequences
+// (Output_fps 0) are written by AsyncFrameWriter, see open_frame_writer.
+static bool open_writer(const WarpJob &job, VideoCapture &cap, double infps, VideoWriter &writer)
+{
+	if (!check_output_codec(job, cap))
+		return false;
+	double fps = job.outputfps < 0 ? infps : job.outputfps;
+	bool ok = writer.open(job.outputfile, output_fourcc(job, cap), fps, job.params.outputsize, true);
+	if (!ok)
+		fprintf(stderr, "Could not open output %s\n", job.outputfile.c_str());
+	return ok;
+}
+
+// true if AngleX / AngleY increments make the maps change every frame,
+// transformtype 4 does not use the angles
+static bool maps_per_frame(const WarpJob &job)
+{
+	return (job.anglexincr != 0 || job.angleyincr != 0) && job.params.transformtype != 4;
+}
+
+bool prepare_frame_warp(const WarpJob &job, const WarpParams &p, long long index, FrameWarp &fw)
+{
+	fw.usemesh = job.meshwarp && p.transformtype == 4;
+	fw.planar = false;
+	fw.mip = false;
+	fw.stream = false;
+	fw.profile = PROFILE_STANDARD;
+	if (fw.usemesh)
+	{
+		// the angles are not used for transformtype 4, this is done once
+		WarpMesh mesh;
+		if (!read_mesh_file(p.mapfile, mesh))
+		{
+			fprintf(stderr, "Could not read map file %s\n", p.mapfile.c_str());
+			return false;
+		}
+		// the mesh engine steps along a regular grid, other meshes are
+		// rasterised into full size maps like without --mesh
+		if (mesh_is_regular(mesh, p.outputsize))
+		{
+			plan_mesh_warp(mesh, p.inputsize, p.outputsize, fw.meshplan);
+			fw.blend = job.blend;
+			return true;
+		}
+		fprintf(stderr, "The mesh in %s is not a regular grid, using full size maps instead of --mesh\n",
+			p.mapfile.c_str());
+		fw.usemesh = false;
+	}
+
+	WarpParams q = p;
+	q.anglex = p.anglex + index * job.anglexincr;
+	q.angley = p.angley + index * job.angleyincr;
+	if (job.stream)
+	{
+		// the maps of each band are made as the frame is warped
+		fw.stream = true;
+		fw.blend = false;
+		fw.maps = WarpMaps();
+		return plan_streaming_remap(q, fw.streamplan);
+	}
+	if (!build_warp_maps(q, fw.maps))
+		return false;
+	fw.blend = job.blend && !fw.maps.gain.empty() && fw.maps.map2_x.empty();
+	if (fw.blend)
+		plan_gain_remap(fw.maps.map_x, fw.maps.map_y, fw.maps.gain, fw.maps.srcsize, job.gamma, fw.gainplan);
+	// single pass maps only, the blend has its own engine
+	fw.mip = job.mip && !fw.blend && fw.maps.map2_x.empty();
+	if (fw.mip)
+		plan_mip_remap(fw.maps.map_x, fw.maps.map_y, fw.maps.srcsize, fw.mipplan);
+	fw.planar = job.planar && !fw.blend && !fw.mip && fw.maps.map2_x.empty();
+	if (fw.planar)
+		plan_planar_remap(fw.maps.map_x, fw.maps.map_y, fw.maps.srcsize, fw.planarplan);
+	if (fw.blend || fw.mip || fw.planar || !fw.maps.map2_x.empty())
+		return true;
+
+	fw.profile = job.profile;
+	if (fw.profile == PROFILE_PREVIEW)
+	{
+		Mat unused;
+		convertMaps(fw.maps.map_x, fw.maps.map_y, fw.nearest, unused, CV_16SC2, true);
+	}
+	else if (fw.profile == PROFILE_MASTER)
+	{
+		plan_mip_remap(fw.maps.map_x, fw.maps.map_y, fw.maps.srcsize, fw.mipplan);
+		fw.minified = fw.mipplan.lod > 0;
+		if (countNonZero(fw.minified) == 0)
+			fw.minified.release();
+		// 4x4 subsamples along the edge of the picture. The centre of a partly
+		// covered pixel may have no source, so its colour is sampled where its
+		// covered subsamples are.
+		Mat coverage, centroid;
+		if (!edge_coverage(q, 4, coverage, &centroid))
+			return false;
+		fw.edgepixels.clear();
+		fw.edgecoverage.clear();
+		std::vector<Point2f> sources;
+		for (int j = 0; j < coverage.rows; j++)
+		{
+			const float *c = coverage.ptr<float>(j);
+			const Point2f *s = centroid.ptr<Point2f>(j);
+			for (int i = 0; i < coverage.cols; i++)
+			{
+				if (c[i] > 0 && c[i] < 1)
+				{
+					fw.edgepixels.push_back(Point(i, j));
+					fw.edgecoverage.push_back(c[i]);
+					sources.push_back(s[i]);
+				}
+			}
+		}
+		// rows of 1024, remap takes at most SHRT_MAX columns
+		const int width = 1024;
+		sources.resize((sources.size() + width - 1) / width * width, Point2f(0, 0));
+		fw.edgesource.release();
+		if (!sources.empty())
+			fw.edgesource = Mat(sources, true).reshape(2, (int)sources.size() / width);
+	}
+	return true;
+}
+
+// Lanczos, then the minified pixels from the mip pyramid, then the edge pixels
+// sampled at their covered subsamples and scaled by coverage
+static void master_warp(const Mat &src, Mat &dst, const FrameWarp &fw)
+{
+	remap(src, dst, fw.maps.map_x, fw.maps.map_y, INTER_LANCZOS4, BORDER_CONSTANT, Scalar(0, 0, 0));
+	if (!fw.minified.empty())
+	{
+		Mat mipped;
+		LazyMipPyramid pyramid(src, fw.mipplan);
+		mip_remap(pyramid, mipped, fw.mipplan);
+		mipped.copyTo(dst, fw.minified);
+	}
+	CV_Assert(dst.type() == CV_8UC3);
+	if (fw.edgepixels.empty())
+		return;
+	// replicated, the centroids are inside the source but their taps may not be
+	Mat edge;
+	remap(src, edge, fw.edgesource, noArray(), INTER_LINEAR, BORDER_REPLICATE);
+	const Vec3b *e = edge.ptr<Vec3b>(0);	// continuous, in the order of edgepixels
+	for (size_t k = 0; k < fw.edgepixels.size(); k++)
+	{
+		Vec3b &v = dst.at<Vec3b>(fw.edgepixels[k]);
+		for (int c = 0; c < 3; c++)
+			v[c] = saturate_cast<uchar>(e[k][c] * fw.edgecoverage[k]);
+	}
+}
+
+void apply_frame_warp(const Mat &src, Mat &dst, const FrameWarp &fw)
+{
+	if (fw.usemesh)
+		mesh_warp(src, dst, fw.meshplan, fw.blend);
+	else if (fw.stream)
+		streaming_remap(src, dst, fw.streamplan);
+	else if (fw.blend)
+		gain_remap(src, dst, fw.gainplan);
+	else if (fw.mip)
+	{
+		// only the tiles the maps read at each level are made
+		LazyMipPyramid pyramid(src, fw.mipplan);
+		mip_remap(pyramid, dst, fw.mipplan);
+	}
+	else if (fw.planar)
+	{
+		// deinterleaved once in, interleaved once out for the encoder
+		std::vector<Mat> srcplanes, dstplanes;
+		split(src, srcplanes);
+		planar_remap(srcplanes, dstplanes, fw.planarplan);
+		merge(dstplanes, dst);
+	}
+	else if (fw.profile == PROFILE_PREVIEW)
+		remap(src, dst, fw.nearest, Mat(), INTER_NEAREST, BORDER_CONSTANT, Scalar(0, 0, 0));
+	else if (fw.profile == PROFILE_MASTER)
+		master_warp(src, dst, fw);
+	else
+		warp_frame(src, dst, fw.maps);
+}
+
+// in (part of a frame) to out, CV_8UC3 of the same size
+static void convert_region(const Mat &in, Mat &out)
+{
+	Mat m = in;
+	if (in.depth() != CV_8U)
+		in.convertTo(m, CV_MAKETYPE(CV_8U, in.channels()), in.depth() == CV_16U ? 1.0 / 256 : 1.0);
+	if (m.channels() == 1)
+		cvtColor(m, out, COLOR_GRAY2BGR);
+	else if (m.channels() == 4)
+		cvtColor(m, out, COLOR_BGRA2BGR);
+	else
+		m.copyTo(out);
+}
+
+void convert_source(const Mat &frame, Mat &src, const WarpMaps &maps)
+{
+	if (frame.type() == CV_8UC3)
+	{
+		src = frame;
+		return;
+	}
+	src.create(frame.size(), CV_8UC3);
+	if (maps.srcbands.empty() || frame.size() != maps.srcsize)
+	{
+		convert_region(frame, src);
+		return;
+	}
+	for (size_t b = 0; b < maps.srcbands.size(); b++)
+	{
+		const Rect &r = maps.srcbands[b];
+		if (r.empty())
+			continue;
+		Mat out = src(r);
+		convert_region(frame(r), out);
+	}
+}
+
+void convert_source(const Mat &frame, Mat &src, const FrameWarp &fw)
+{
+	if ((fw.mip || fw.profile == PROFILE_MASTER) && frame.type() != CV_8UC3)
+	{
+		src.create(frame.size(), CV_8UC3);
+		convert_region(frame, src);
+	}
+	else if (fw.stream && frame.type() != CV_8UC3)
+	{
+		// the bands only read within the source box
+		src.create(frame.size(), CV_8UC3);
+		const Rect box = fw.streamplan.srcbox & Rect(Point(0, 0), frame.size());
+		Mat out = src(box);
+		convert_region(frame(box), out);
+	}
+	else
+		convert_source(frame, src, fw.maps);
+}
+
+static double elapsed_ms(int64 t0)
+{
+	return (getTickCount() - t0) * 1000.0 / getTickFrequency();
+}
+
+// elapsed_ms, also added to the stage's histogram if times is not 0
+static double stage_ms(StageTimes *times, int stage, int64 t0)
+{
+	double ms = elapsed_ms(t0);
+	if (times)
+		times->add(stage, ms);
+	return ms;
+}
+
+static bool timed_prepare(const WarpJob &job, const WarpParams &p, long long index, FrameWarp &fw)
+{
+	ScopedStageTimer t(job.timing, STAGE_MAPS);
+	if (prepare_frame_warp(job, p, index, fw))
+		return true;
+	fprintf(stderr, "\nCould not make the maps for frame %lld\n", index);
+	return false;
+}
+
+static void timed_warp(const WarpJob &job, const Mat &src, Mat &dst, const FrameWarp &fw)
+{
+	ScopedStageTimer t(job.timing, STAGE_WARP);
+	apply_frame_warp(src, dst, fw);
+}
+
+// while in scope, OpenCV does not use its own threads. The workers
+// parallelise over frames, so this keeps cv::remap from also spreading each
+// frame over OpenCV's thread pool.
+struct SingleThreadedOpenCV
+{
+	SingleThreadedOpenCV() : saved(getNumThreads()) { setNumThreads(1); }
+	~SingleThreadedOpenCV() { setNumThreads(saved); }
+	int saved;
+};
+
+static void clear_stats(PipelineStats &stats)
+{
+	stats.frames = 0;
+	stats.wallms = stats.decodems = stats.warpms = stats.encodems = 0;
+	stats.decodewaitms = stats.encodewaitms = 0;
+	stats.decodeallocs = 0;
+	stats.encodefps = 0;
+	stats.maxreorder = 0;
+	stats.meanreorder = 0;
+	stats.encodedbytes = 0;
+}
+
+// imwrite through a buffer kept by the caller, so that encoding does not
+// allocate once buffer has grown to the frame size. Bytes written, 0 on failure.
+static size_t write_image(const std::string &name, const Mat &frame, const std::vector<int> &params,
+	std::vector<uchar> &buffer)
+{
+	size_t dot = name.find_last_of('.');
+	size_t n = 0;
+	if (dot != std::string::npos && imencode(name.substr(dot), frame, buffer, params))
+	{
+		FILE *f = fopen(name.c_str(), "wb");
+		if (f)
+		{
+			n = fwrite(buffer.data(), 1, buffer.size(), f);
+			if (fclose(f) != 0 || n != buffer.size())
+				n = 0;
+		}
+	}
+	if (n == 0)
+		fprintf(stderr, "\nCould not write %s\n", name.c_str());
+	return n;
+}
+
+bool is_sequence_pattern(const std::string &pattern)
+{
+	int conversions = 0;
+	for (size_t k = 0; k < pattern.size(); k++)
+	{
+		if (pattern[k] != '%')
+			continue;
+		if (++k < pattern.size() && pattern[k] == '%')
+			continue;
+		// flags, width and precision, then d or i - the index is passed as an int
+		while (k < pattern.size() && strchr("-+ #0", pattern[k]))
+			k++;
+		while (k < pattern.size() && (isdigit((unsigned char)pattern[k]) || pattern[k] == '.'))
+			k++;
+		if (k >= pattern.size() || (pattern[k] != 'd' && pattern[k] != 'i'))
+			return false;
+		conversions++;
+	}
+	return conversions == 1;
+}
+
+// stops the run if pattern cannot number the files of a sequence
+static bool check_sequence_pattern(const std::string &pattern)
+{
+	if (is_sequence_pattern(pattern))
+		return true;
+	fprintf(stderr, "%s needs exactly one %%d style frame number, like frame%%05d.png\n", pattern.c_str());
+	return false;
+}
+
+// image sequences for Output_fps 0 and intermediate files are written by
+// writer itself, with the compression of the job
+static bool open_frame_writer(const WarpJob &job, AsyncFrameReader &reader, AsyncFrameWriter &writer)
+{
+	if (is_raw_file(job.outputfile))
+	{
+		// PNG compressed with the job's level, else uncompressed planes
+		int level = job.compression == COMPRESSION_FAST ? 1 : job.compression;
+		double fps = job.outputfps > 0 ? job.outputfps : reader.fps();
+		if (writer.raw().open(job.outputfile, job.params.outputsize, CV_8UC3, fps, level))
+			return true;
+		fprintf(stderr, "Could not open output %s\n", job.outputfile.c_str());
+		return false;
+	}
+	if (job.outputfps == 0)
+	{
+		if (!check_sequence_pattern(job.outputfile))
+			return false;
+		writer.sequence(job.outputfile, sequence_write_params(job.outputfile, job.compression));
+		return true;
+	}
+	return open_writer(job, reader.capture(), reader.fps(), writer.writer());
+}
+
+// the input, a video opened at job.startframe or an intermediate file
+static bool open_frame_reader(const WarpJob &job, AsyncFrameReader &reader, WarpParams &p)
+{
+	if (!is_raw_file(job.inputfile))
+		return open_input_at(job, reader.capture(), p);
+	if (!reader.raw().open(job.inputfile) || reader.raw().type() != CV_8UC3)
+	{
+		fprintf(stderr, "Could not open input %s\n", job.inputfile.c_str());
+		return false;
+	}
+	p = job.params;
+	p.inputsize = reader.raw().size();
+	return true;
+}
+
+// the reader's and writer's counters into stats
+static void collect_io_stats(const AsyncFrameReader &reader, const AsyncFrameWriter &writer, PipelineStats &stats)
+{
+	stats.frames = writer.written;
+	stats.decodems = reader.decodems;
+	stats.decodewaitms = reader.waitms;
+	stats.decodeallocs = reader.allocations;
+	stats.encodems = writer.encodems;
+	stats.encodewaitms = writer.idlems;
+	stats.encodefps = writer.encodems > 0 ? writer.written * 1000.0 / writer.encodems : 0;
+	stats.encodedbytes = writer.bytes;
+	stats.maxreorder = writer.maxdepth;
+	stats.meanreorder = writer.meandepth;
+}
+
+AsyncFrameReader::AsyncFrameReader()
+	: decodems(0), waitms(0), allocations(0), timing(0), freeslots(1), ready(1)
+{
+}
+
+AsyncFrameReader::~AsyncFrameReader()
+{
+	close();
+}
+
+void AsyncFrameReader::start(int poolsize, long long first, long long count)
+{
+	pool.assign(poolsize, Mat());
+	freeslots.reset(poolsize);
+	ready.reset(poolsize);
+	for (int k = 0; k < poolsize; k++)
+		freeslots.push(k);
+
+	decoder = std::thread([this, first, count]()
+	{
+		int slot;
+		for (long long k = 0; count < 0 || k < count; k++)
+		{
+			int64 t0 = getTickCount();
+			if (!freeslots.pop(slot))
+				break;
+			waitms += elapsed_ms(t0);
+
+			// into the slot's buffer, which is kept when the size and type match
+			if (!read(first + k, pool[slot]))
+				break;
+
+			PooledFrame f;
+			f.index = first + k;
+			f.slot = slot;
+			f.frame = pool[slot];
+			if (!ready.push(f))
+				break;
+		}
+		ready.close();
+	});
+}
+
+bool AsyncFrameReader::read(long long index, Mat &frame)
+{
+	int64 t0 = getTickCount();
+	const uchar *before = frame.data;
+	// intermediate files are read at the frame index, there is nothing to seek
+	bool ok = file.is_open() ? file.read(index, frame) : cap.read(frame) && !frame.empty();
+	decodems += stage_ms(timing, STAGE_DECODE, t0);
+	if (ok && frame.data != before)
+		allocations++;
+	return ok;
+}
+
+double AsyncFrameReader::fps()
+{
+	return file.is_open() ? file.fps() : cap.get(CAP_PROP_FPS);
+}
+
+bool AsyncFrameReader::next(PooledFrame &f)
+{
+	return ready.pop(f);
+}
+
+void AsyncFrameReader::recycle(const PooledFrame &f)
+{
+	freeslots.push(f.slot);
+}
+
+void AsyncFrameReader::close()
+{
+	freeslots.close();
+	ready.close();
+	if (decoder.joinable())
+		decoder.join();
+}
+
+AsyncFrameWriter::AsyncFrameWriter()
+	: written(0), encodems(0), idlems(0), maxdepth(0), meandepth(0), bytes(0), timing(0), window(1), nextindex(0),
+	finishing(false), cancelled(false), depthsum(0), depthcount(0)
+{
+}
+
+void AsyncFrameWriter::sequence(const std::string &filepattern, const std::vector<int> &writeparams)
+{
+	pattern = filepattern;
+	params = writeparams;
+}
+
+AsyncFrameWriter::~AsyncFrameWriter()
+{
+	finish();
+}
+
+void AsyncFrameWriter::start(size_t frames)
+{
+	window = frames > 0 ? frames : 1;
+	encoder = std::thread([this]()
+	{
+		std::unique_lock<std::mutex> lock(m);
+		for (;;)
+		{
+			int64 t0 = getTickCount();
+			arrived.wait(lock, [this]() { return finishing || pending.count(nextindex) > 0; });
+			idlems += elapsed_ms(t0);
+			if (pending.empty() || cancelled)
+				break;
+			// at the end, skip over frames which never came
+			std::map<long long, Mat>::iterator it = pending.begin();
+			if (it->first != nextindex && !finishing)
+				continue;
+			Mat frame = it->second;
+			nextindex = it->first;
+			lock.unlock();
+
+			encode(nextindex, frame);
+
+			lock.lock();
+			pending.erase(nextindex);
+			nextindex++;
+			advanced.notify_all();
+		}
+	});
+}
+
+void AsyncFrameWriter::encode(long long index, const Mat &frame)
+{
+	int64 t0 = getTickCount();
+	if (file.is_open())
+	{
+		if (!file.write(frame))
+			fprintf(stderr, "\nCould not write frame %lld\n", index);
+	}
+	else if (pattern.empty())
+		out.write(frame);
+	else
+		bytes += write_image(sequence_filename(pattern, index), frame, params, buffer);
+	encodems += stage_ms(timing, STAGE_ENCODE, t0);
+	written++;
+	if (written % 100 == 0)
+		printf("\rFrame %lld", written);
+}
+
+void AsyncFrameWriter::write(long long index, const Mat &frame)
+{
+	std::unique_lock<std::mutex> lock(m);
+	advanced.wait(lock, [&]() { return index < nextindex + (long long)window || finishing; });
+	if (cancelled)
+		return;
+	pending[index] = frame;
+	maxdepth = std::max(maxdepth, pending.size());
+	depthsum += pending.size();
+	depthcount++;
+	meandepth = depthsum / depthcount;
+	arrived.notify_one();
+}
+
+void AsyncFrameWriter::cancel()
+{
+	std::lock_guard<std::mutex> lock(m);
+	cancelled = true;
+	finishing = true;
+	arrived.notify_one();
+	advanced.notify_all();
+}
+
+void AsyncFrameWriter::finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		finishing = true;
+		arrived.notify_one();
+		advanced.notify_all();
+	}
+	if (encoder.joinable())
+		encoder.join();
+	if (file.is_open())
+	{
+		bytes = file.bytes;
+		if (!file.close())
+			fprintf(stderr, "Could not finish writing the intermediate file\n");
+	}
+}
+
+// an empty frame range, or options of the job which cannot be used together, yuv for the YUV 4:2:0
+// paths (run_warp_yuv and run_warp_ffmpeg), which only remap bilinear
+static bool check_warp_job(const WarpJob &job, bool yuv = false)
+{
+	if (job.endframe >= 0 && job.endframe <= std::max(job.startframe, 0LL))
+	{
+		fprintf(stderr, "The end frame %lld is not after the start frame %lld\n", job.endframe, job.startframe);
+		return false;
+	}
+	if (job.stream)
+	{
+		const char *other = yuv ? "YUV 4:2:0 warping" : job.blend ? "--blend" : job.mip ? "--mip"
+			: job.planar ? "--planar" : job.meshwarp ? "--mesh"
+			: job.profile != PROFILE_STANDARD ? "a profile other than standard" : 0;
+		if (other)
+		{
+			fprintf(stderr, "--stream cannot be used with %s\n", other);
+			return false;
+		}
+	}
+	if (job.meshwarp && job.gamma != 1.0f)
+	{
+		fprintf(stderr, "--gamma cannot be used with --mesh, which blends in gamma space\n");
+		return false;
+	}
+	if (job.profile == PROFILE_STANDARD)
+		return true;
+	const char *other = yuv ? "YUV 4:2:0 warping" : job.blend ? "--blend" : job.mip ? "--mip"
+		: job.planar ? "--planar" : job.meshwarp ? "--mesh" : 0;
+	if (!other)
+		return true;
+	fprintf(stderr, "The %s profile cannot be used with %s, which has its own interpolation\n",
+		profile_name(job.profile), other);
+	return false;
+}
+
+bool run_warp_sequential(const WarpJob &job, PipelineStats &stats)
+{
+	clear_stats(stats);
+	if (!check_warp_job(job))
+		return false;
+	// only for opening the input and output, nothing runs on their threads
+	AsyncFrameReader reader;
+	AsyncFrameWriter writer;
+	WarpParams p;
+	FrameWarp fw;
+	if (!open_frame_reader(job, reader, p) || !prepare_frame_warp(job, p, job.startframe, fw)
+		|| !open_frame_writer(job, reader, writer))
+		return false;
+
+	const bool perframe = maps_per_frame(job);
+	const long long count = range_frames(job);
+	int64 tstart = getTickCount();
+	reader.timing = job.timing;
+	writer.timing = job.timing;
+	Mat src, dst;
+	bool failed = false;
+	for (long long k = 0; count < 0 || k < count; k++)
+	{
+		const long long index = job.startframe + k;
+		if (!reader.read(index, src))
+			break;
+		int64 t0 = getTickCount();
+		if (perframe && k > 0 && !timed_prepare(job, p, index, fw))
+		{
+			failed = true;
+			break;
+		}
+		timed_warp(job, src, dst, fw);
+		stats.warpms += elapsed_ms(t0);
+		writer.encode(k, dst);
+	}
+	writer.finish();
+	stats.wallms = elapsed_ms(tstart);
+	collect_io_stats(reader, writer, stats);
+	printf("\n");
+	return !failed;
+}
+
+bool run_warp_overlapped(const WarpJob &job, PipelineStats &stats)
+{
+	clear_stats(stats);
+	if (!check_warp_job(job))
+		return false;
+	AsyncFrameReader reader;
+	AsyncFrameWriter writer;
+	WarpParams p;
+	FrameWarp fw;
+	if (!open_frame_reader(job, reader, p) || !prepare_frame_warp(job, p, job.startframe, fw)
+		|| !open_frame_writer(job, reader, writer))
+		return false;
+
+	const bool perframe = maps_per_frame(job);
+	int64 tstart = getTickCount();
+	// decoding the next frames and encoding the last ones while this one is warped
+	reader.timing = job.timing;
+	writer.timing = job.timing;
+	reader.start(3, job.startframe, range_frames(job));
+	writer.start(3);
+	PooledFrame f;
+	bool failed = false;
+	while (reader.next(f))
+	{
+		int64 t0 = getTickCount();
+		if (perframe && f.index > job.startframe && !timed_prepare(job, p, f.index, fw))
+		{
+			failed = true;
+			writer.cancel();
+			break;
+		}
+		// a new frame each time, the writer holds on to it
+		Mat dst;
+		timed_warp(job, f.frame, dst, fw);
+		reader.recycle(f);
+		stats.warpms += elapsed_ms(t0);
+		writer.write(f.index - job.startframe, dst);
+	}
+	reader.close();
+	writer.finish();
+	stats.wallms = elapsed_ms(tstart);
+	collect_io_stats(reader, writer, stats);
+	printf("\n");
+	return !failed;
+}
+
+bool run_warp_pipeline(const WarpJob &job, int nworkers, PipelineStats &stats)
+{
+	clear_stats(stats);
+	if (!check_warp_job(job))
+		return false;
+	AsyncFrameReader reader;
+	AsyncFrameWriter writer;
+	WarpParams p;
+	FrameWarp fw;
+	if (!open_frame_reader(job, reader, p) || !prepare_frame_warp(job, p, job.startframe, fw)
+		|| !open_frame_writer(job, reader, writer))
+		return false;
+
+	if (nworkers < 1)
+		nworkers = 1;
+	const bool perframe = maps_per_frame(job);
+	std::vector<double> warpms(nworkers, 0.0);
+
+	SingleThreadedOpenCV cvthreads;
+	int64 tstart = getTickCount();
+
+	// decoded frames wait in the reader's ring until a worker takes them,
+	// the buffers are reused once warped. Warped frames wait in the writer
+	// until their turn, at most 2 * nworkers + 2 of them.
+	reader.timing = job.timing;
+	writer.timing = job.timing;
+	reader.start(nworkers + 1, job.startframe, range_frames(job));
+	writer.start(2 * nworkers + 2);
+
+	// a frame whose maps cannot be made stops the run, the writer does
+	// not wait for it
+	std::atomic<bool> failed(false);
+	std::vector<std::thread> workers;
+	for (int w = 0; w < nworkers; w++)
+	{
+		workers.push_back(std::thread([&, w]()
+		{
+			FrameWarp local;
+			PooledFrame in;
+			while (!failed && reader.next(in))
+			{
+				int64 t0 = getTickCount();
+				const FrameWarp *m = &fw;
+				if (perframe)
+				{
+					if (!timed_prepare(job, p, in.index, local))
+					{
+						failed = true;
+						writer.cancel();
+						break;
+					}
+					m = &local;
+				}
+				Mat out;
+				timed_warp(job, in.frame, out, *m);
+				reader.recycle(in);
+				warpms[w] += elapsed_ms(t0);
+				writer.write(in.index - job.startframe, out);
+			}
+		}));
+	}
+
+	for (size_t w = 0; w < workers.size(); w++)
+		workers[w].join();
+	reader.close();
+	writer.finish();
+
+	stats.wallms = elapsed_ms(tstart);
+	for (int w = 0; w < nworkers; w++)
+		stats.warpms += warpms[w];
+	collect_io_stats(reader, writer, stats);
+	printf("\n");
+	return !failed;
+}
+
+std::string sequence_filename(const std::string &pattern, long long index)
+{
+	// patterns are %d style, as for OpenCV's image sequences
+	char name[4096];
+	snprintf(name, sizeof(name), pattern.c_str(), (int)index);
+	return name;
+}
+
+static bool file_exists(const std::string &name)
+{
+	std::ifstream f(name.c_str());
+	return f.good();
+}
+
+long long find_sequence_start(const std::string &pattern, long long &count)
+{
+	count = 0;
+	// the same name for every index would never end
+	if (!is_sequence_pattern(pattern))
+		return -1;
+	long long first = -1;
+	for (long long k = 0; k < 10000 && first < 0; k++)
+	{
+		if (file_exists(sequence_filename(pattern, k)))
+			first = k;
+	}
+	if (first < 0)
+		return -1;
+	while (file_exists(sequence_filename(pattern, first + count)))
+		count++;
+	return first;
+}
+
+// the job's frame range within a sequence of count files, as the first
+// frame and the number of frames, false if that leaves none
+static bool sequence_range(const WarpJob &job, long long count, long long &start, long long &n)
+{
+	start = std::min(std::max(job.startframe, 0LL), count);
+	long long end = job.endframe < 0 ? count : std::min(job.endframe, count);
+	n = end - start;
+	if (n <= 0)
+	{
+		fprintf(stderr, "No frames of %s in the range %lld to %lld\n", job.inputfile.c_str(), job.startframe, job.endframe);
+		return false;
+	}
+	return true;
+}
+
+// the start shared by the image sequence runs - the input's first file, the
+// job's range of frames from it, the frame size and the maps for the start
+static bool open_sequence_job(const WarpJob &job, long long &first, long long &start, long long &n,
+	WarpParams &p, FrameWarp &fw)
+{
+	if (!check_sequence_pattern(job.inputfile) || !check_sequence_pattern(job.outputfile))
+		return false;
+	long long count;
+	first = find_sequence_start(job.inputfile, count);
+	if (first < 0)
+	{
+		fprintf(stderr, "No files found for %s\n", job.inputfile.c_str());
+		return false;
+	}
+	Mat firstframe = imread(sequence_filename(job.inputfile, first), IMREAD_COLOR);
+	if (firstframe.empty())
+	{
+		fprintf(stderr, "Could not read %s\n", sequence_filename(job.inputfile, first).c_str());
+		return false;
+	}
+	p = job.params;
+	p.inputsize = firstframe.size();
+	return sequence_range(job, count, start, n) && prepare_frame_warp(job, p, start, fw);
+}
+
+// progress and throughput of the workers, once a second until none are running
+static void print_progress(const std::atomic<int> &running, const std::atomic<long long> &done, long long total,
+	int64 tstart)
+{
+	while (running > 0)
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		double secs = elapsed_ms(tstart) / 1000.0;
+		long long d = done;
+		printf("\rFrame %lld of %lld, %.2f fps, %.0f s to go   ", d, total, d / secs,
+			d > 0 ? (total - d) * secs / d : 0.0);
+		fflush(stdout);
+	}
+}
+
+bool run_sequence_batch(const WarpJob &job, int nworkers, PipelineStats &stats)
+{
+	clear_stats(stats);
+	if (!check_warp_job(job))
+		return false;
+	long long first, start, n;
+	WarpParams p;
+	FrameWarp fw;
+	if (!open_sequence_job(job, first, start, n, p, fw))
+		return false;
+
+	if (nworkers < 1)
+		nworkers = 1;
+	if (nworkers > n)
+		nworkers = (int)n;
+	const bool perframe = maps_per_frame(job);
+	const std::vector<int> writeparams = sequence_write_params(job.outputfile, job.compression);
+	std::vector<PipelineStats> workerstats(nworkers);
+	std::atomic<long long> done(0);
+	std::atomic<int> running(nworkers);
+	std::atomic<bool> failed(false);
+
+	SingleThreadedOpenCV cvthreads;
+	int64 tstart = getTickCount();
+
+	std::vector<std::thread> workers;
+	for (int w = 0; w < nworkers; w++)
+	{
+		workers.push_back(std::thread([&, w]()
+		{
+			PipelineStats &ws = workerstats[w];
+			clear_stats(ws);
+			FrameWarp local;
+			Mat frame, src, dst;
+			std::vector<uchar> buffer;
+			// output files keep the input numbering, so that a range drops into place
+			const long long k0 = start + n * w / nworkers;
+			const long long k1 = start + n * (w + 1) / nworkers;
+			for (long long k = k0; k < k1 && !failed; k++)
+			{
+				int64 t0 = getTickCount();
+				// unchanged, so that grey, alpha and 16 bit frames are only
+				// converted where the maps read them
+				frame = imread(sequence_filename(job.inputfile, first + k), IMREAD_UNCHANGED);
+				ws.decodems += stage_ms(job.timing, STAGE_DECODE, t0);
+				if (frame.empty() || frame.size() != p.inputsize)
+				{
+					fprintf(stderr, "\nSkipping %s\n", sequence_filename(job.inputfile, first + k).c_str());
+					continue;
+				}
+
+				t0 = getTickCount();
+				const FrameWarp *m = &fw;
+				if (perframe)
+				{
+					if (!timed_prepare(job, p, k, local))
+					{
+						failed = true;
+						break;
+					}
+					m = &local;
+				}
+				convert_source(frame, src, *m);
+				timed_warp(job, src, dst, *m);
+				ws.warpms += elapsed_ms(t0);
+
+				t0 = getTickCount();
+				ws.encodedbytes += write_image(sequence_filename(job.outputfile, k), dst, writeparams, buffer);
+				ws.encodems += stage_ms(job.timing, STAGE_ENCODE, t0);
+				ws.frames++;
+				done++;
+			}
+			running--;
+		}));
+	}
+
+	print_progress(running, done, n, tstart);
+	for (int w = 0; w < nworkers; w++)
+	{
+		workers[w].join();
+		stats.frames += workerstats[w].frames;
+		stats.decodems += workerstats[w].decodems;
+		stats.warpms += workerstats[w].warpms;
+		stats.encodems += workerstats[w].encodems;
+		stats.encodedbytes += workerstats[w].encodedbytes;
+	}
+	stats.wallms = elapsed_ms(tstart);
+	printf("\n");
+	return !failed && stats.frames == n;
+}
+
+std::vector<int> sequence_write_params(const std::string &pattern, int level)
+{
+	std::vector<int> params;
+	if (level < 0 && level != COMPRESSION_FAST)
+		return params;
+	std::string ext = pattern.substr(pattern.find_last_of('.') + 1);
+	for (size_t k = 0; k < ext.size(); k++)
+		ext[k] = (char)tolower(ext[k]);
+	if (level == COMPRESSION_FAST)
+	{
+		// lossless, for throughput rather than size
+		if (ext == "png")
+		{
+			params.push_back(IMWRITE_PNG_COMPRESSION);
+			params.push_back(1);
+		}
+		else if (ext == "tif" || ext == "tiff")
+		{
+			// PackBits
+			params.push_back(IMWRITE_TIFF_COMPRESSION);
+			params.push_back(32773);
+		}
+		return params;
+	}
+	if (ext == "png")
+	{
+		params.push_back(IMWRITE_PNG_COMPRESSION);
+		params.push_back(std::min(level, 9));
+	}
+	else if (ext == "jpg" || ext == "jpeg")
+	{
+		params.push_back(IMWRITE_JPEG_QUALITY);
+		params.push_back(std::min(level, 100));
+	}
+	else if (ext == "webp")
+	{
+		params.push_back(IMWRITE_WEBP_QUALITY);
+		params.push_back(std::max(1, std::min(level, 100)));
+	}
+	else if (ext == "tif" || ext == "tiff")
+	{
+		params.push_back(IMWRITE_TIFF_COMPRESSION);
+		params.push_back(level);
+	}
+	return params;
+}
+
+SequenceReader::SequenceReader(const std::string &pattern, long long first, long long count,
+	int ndecoders, int readahead, StageTimes *timing)
+	: decodems(0), timing(timing), pattern(pattern), first(first), count(count), readahead(std::max(readahead, ndecoders)),
+	nextread(0), nextout(0), closed(false)
+{
+	for (int d = 0; d < ndecoders; d++)
+	{
+		decoders.push_back(std::thread([this]()
+		{
+			std::unique_lock<std::mutex> lock(m);
+			for (;;)
+			{
+				changed.wait(lock, [this]() { return closed || nextread >= this->count
+					|| nextread < nextout + this->readahead; });
+				if (closed || nextread >= this->count)
+					break;
+				long long k = nextread++;
+				lock.unlock();
+
+				int64 t0 = getTickCount();
+				Mat frame = imread(sequence_filename(this->pattern, this->first + k), IMREAD_UNCHANGED);
+				double ms = stage_ms(this->timing, STAGE_DECODE, t0);
+
+				lock.lock();
+				decodems += ms;
+				decoded[k] = frame;
+				changed.notify_all();
+			}
+		}));
+	}
+}
+
+SequenceReader::~SequenceReader()
+{
+	close();
+}
+
+bool SequenceReader::next(long long &index, Mat &frame)
+{
+	std::unique_lock<std::mutex> lock(m);
+	changed.wait(lock, [this]() { return closed || nextout >= count || decoded.count(nextout) > 0; });
+	if (closed || nextout >= count)
+		return false;
+	index = nextout++;
+	frame = decoded[index];
+	decoded.erase(index);
+	// room for one more to be read ahead
+	changed.notify_all();
+	return true;
+}
+
+void SequenceReader::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		closed = true;
+		changed.notify_all();
+	}
+	for (size_t d = 0; d < decoders.size(); d++)
+		if (decoders[d].joinable())
+			decoders[d].join();
+}
+
+SequenceWriter::SequenceWriter(const std::string &pattern, int nencoders, const std::vector<int> &params,
+	StageTimes *timing)
+	: encodems(0), bytes(0), timing(timing), pattern(pattern), params(params), queue(2 * std::max(nencoders, 1)), failed(false)
+{
+	for (int e = 0; e < std::max(nencoders, 1); e++)
+	{
+		encoders.push_back(std::thread([this]()
+		{
+			std::pair<long long, Mat> item;
+			std::vector<uchar> buffer;
+			while (queue.pop(item))
+			{
+				int64 t0 = getTickCount();
+				size_t n = write_image(sequence_filename(this->pattern, item.first), item.second, this->params, buffer);
+				double ms = stage_ms(this->timing, STAGE_ENCODE, t0);
+
+				std::lock_guard<std::mutex> lock(m);
+				encodems += ms;
+				bytes += n;
+				if (n == 0)
+					failed = true;
+			}
+		}));
+	}
+}
+
+SequenceWriter::~SequenceWriter()
+{
+	finish();
+}
+
+void SequenceWriter::write(long long index, const Mat &frame)
+{
+	queue.push(std::make_pair(index, frame));
+}
+
+bool SequenceWriter::finish()
+{
+	// the encoders empty the queue before they stop
+	queue.close();
+	for (size_t e = 0; e < encoders.size(); e++)
+		if (encoders[e].joinable())
+			encoders[e].join();
+	return !failed;
+}
+
+bool run_sequence_pipeline(const WarpJob &job, int nworkers, int ncodecs, PipelineStats &stats)
+{
+	clear_stats(stats);
+	if (!check_warp_job(job))
+		return false;
+	long long first, start, n;
+	WarpParams p;
+	FrameWarp fw;
+	if (!open_sequence_job(job, first, start, n, p, fw))
+		return false;
+
+	if (nworkers < 1)
+		nworkers = 1;
+	if (ncodecs < 1)
+		ncodecs = 1;
+	const bool perframe = maps_per_frame(job);
+	std::vector<double> warpms(nworkers, 0.0);
+	std::atomic<long long> done(0), skipped(0);
+	std::atomic<int> running(nworkers);
+	std::atomic<bool> failed(false);
+
+	SingleThreadedOpenCV cvthreads;
+	int64 tstart = getTickCount();
+
+	SequenceReader reader(job.inputfile, first + start, n, ncodecs, ncodecs + nworkers, job.timing);
+	SequenceWriter writer(job.outputfile, ncodecs, sequence_write_params(job.outputfile, job.compression), job.timing);
+
+	std::vector<std::thread> workers;
+	for (int w = 0; w < nworkers; w++)
+	{
+		workers.push_back(std::thread([&, w]()
+		{
+			FrameWarp local;
+			long long k;
+			Mat frame, src;
+			while (!failed && reader.next(k, frame))
+			{
+				// numbered as in the input, like run_sequence_batch
+				k += start;
+				if (frame.empty() || frame.size() != p.inputsize)
+				{
+					fprintf(stderr, "\nSkipping %s\n", sequence_filename(job.inputfile, first + k).c_str());
+					skipped++;
+					continue;
+				}
+				int64 t0 = getTickCount();
+				const FrameWarp *m = &fw;
+				if (perframe)
+				{
+					if (!timed_prepare(job, p, k, local))
+					{
+						failed = true;
+						break;
+					}
+					m = &local;
+				}
+				convert_source(frame, src, *m);
+				Mat dst;
+				timed_warp(job, src, dst, *m);
+				warpms[w] += elapsed_ms(t0);
+				writer.write(k, dst);
+				done++;
+			}
+			running--;
+		}));
+	}
+
+	print_progress(running, done, n, tstart);
+	for (int w = 0; w < nworkers; w++)
+	{
+		workers[w].join();
+		stats.warpms += warpms[w];
+	}
+	reader.close();
+	bool ok = writer.finish();
+	stats.wallms = elapsed_ms(tstart);
+	stats.frames = done;
+	stats.decodems = reader.decodems;
+	stats.encodems = writer.encodems;
+	stats.encodedbytes = writer.bytes;
+	printf("\n");
+	return ok && !failed && skipped == 0;
+}
+
+// the YUV remap for input frame index, with the angle increments
+static bool plan_yuv_frame(const WarpJob &job, const WarpParams &p, long long index, WarpMaps &maps, YuvRemap &plan)
+{
+	WarpParams q = p;
+	q.anglex = p.anglex + index * job.anglexincr;
+	q.angley = p.angley + index * job.angleyincr;
+	if (!build_warp_maps(q, maps))
+		return false;
+	plan_yuv_remap(maps.map_x, maps.map_y, p.inputsize, plan);
+	return true;
+}
+
+static bool timed_plan_yuv_frame(const WarpJob &job, const WarpParams &p, long long index, WarpMaps &maps, YuvRemap &plan)
+{
+	ScopedStageTimer t(job.timing, STAGE_MAPS);
+	return plan_yuv_frame(job, p, index, maps, plan);
+}
+
+// I420 frames of p.inputsize from in, warped, to out. The first frame read is
+// input frame job.startframe, after reading past skip frames; it stops at
+// job.endframe.
+static bool warp_yuv_stream(const WarpJob &job, const WarpParams &p, FILE *in, FILE *out,
+	long long skip, PipelineStats &stats)
+{
+	if (p.inputsize.width % 2 || p.inputsize.height % 2 || p.outputsize.width % 2 || p.outputsize.height % 2)
+	{
+		fprintf(stderr, "YUV 4:2:0 needs even frame sizes\n");
+		return false;
+	}
+	WarpMaps maps;
+	YuvRemap plan;
+	if (!plan_yuv_frame(job, p, job.startframe, maps, plan))
+		return false;
+
+	const bool perframe = maps_per_frame(job);
+	const long long nframes = range_frames(job);
+	int64 tstart = getTickCount();
+	Mat src(p.inputsize.height * 3 / 2, p.inputsize.width, CV_8UC1), dst;
+	// raw frames have no index to seek with, and stdin cannot seek
+	for (long long k = 0; k < skip; k++)
+		if (fread(src.data, 1, src.total(), in) != src.total())
+			break;
+	while (nframes < 0 || stats.frames < nframes)
+	{
+		int64 t0 = getTickCount();
+		if (fread(src.data, 1, src.total(), in) != src.total())
+			break;
+		stats.decodems += stage_ms(job.timing, STAGE_DECODE, t0);
+
+		t0 = getTickCount();
+		if (perframe && stats.frames > 0
+			&& !timed_plan_yuv_frame(job, p, job.startframe + stats.frames, maps, plan))
+		{
+			fprintf(stderr, "Could not make the maps for frame %lld\n", job.startframe + stats.frames);
+			return false;
+		}
+		{
+			ScopedStageTimer timer(job.timing, STAGE_WARP);
+			yuv_remap(src, dst, plan);
+		}
+		stats.warpms += elapsed_ms(t0);
+
+		t0 = getTickCount();
+		bool written = fwrite(dst.data, 1, dst.total(), out) == dst.total();
+		stats.encodems += stage_ms(job.timing, STAGE_ENCODE, t0);
+		if (!written)
+		{
+			fprintf(stderr, "Could not write frame %lld\n", stats.frames);
+			break;
+		}
+
+		stats.frames++;
+		// stdout may be the video
+		if (stats.frames % 100 == 0)
+			fprintf(stderr, "\rFrame %lld", stats.frames);
+	}
+	stats.wallms = elapsed_ms(tstart);
+	fprintf(stderr, "\n");
+	return true;
+}
+
+bool run_warp_yuv(const WarpJob &job, Size inputsize, PipelineStats &stats)
+{
+	clear_stats(stats);
+	if (!check_warp_job(job, true))
+		return false;
+	WarpParams p = job.params;
+	p.inputsize = inputsize;
+
+	FILE *in = job.inputfile == "-" ? stdin : fopen(job.inputfile.c_str(), "rb");
+	if (!in)
+	{
+		fprintf(stderr, "Could not open input %s\n", job.inputfile.c_str());
+		return false;
+	}
+	FILE *out = job.outputfile == "-" ? stdout : fopen(job.outputfile.c_str(), "wb");
+	if (!out)
+	{
+		fprintf(stderr, "Could not open output %s\n", job.outputfile.c_str());
+		if (in != stdin)
+			fclose(in);
+		return false;
+	}
+
+	bool ok = warp_yuv_stream(job, p, in, out, std::max(job.startframe, 0LL), stats);
+	if (in != stdin)
+		fclose(in);
+	if (out != stdout)
+		fclose(out);
+	else
+		fflush(out);
+	return ok;
+}
+
+std::string ffmpeg_encoder_args(const std::string &fourcc)
+{
+	static const char *codecs[][2] =
+	{
+		{ "H264", "-c:v libx264" }, { "h264", "-c:v libx264" }, { "X264", "-c:v libx264" },
+		{ "x264", "-c:v libx264" }, { "avc1", "-c:v libx264" },
+		{ "HEVC", "-c:v libx265" }, { "H265", "-c:v libx265" }, { "hvc1", "-c:v libx265 -tag:v hvc1" },
+		{ "hev1", "-c:v libx265" },
+		// without a quality these fall back to ffmpeg's 200 kb/s default
+		{ "XVID", "-c:v mpeg4 -vtag xvid -q:v 2" }, { "DIVX", "-c:v mpeg4 -vtag DIVX -q:v 2" },
+		{ "FMP4", "-c:v mpeg4 -q:v 2" }, { "MP4V", "-c:v mpeg4 -q:v 2" }, { "mp4v", "-c:v mpeg4 -q:v 2" },
+		{ "MJPG", "-c:v mjpeg -q:v 2" }, { "FFV1", "-c:v ffv1" },
+		{ "VP80", "-c:v libvpx -crf 10 -b:v 50M" }, { "VP90", "-c:v libvpx-vp9 -crf 31 -b:v 0" },
+		{ "AV01", "-c:v libaom-av1 -crf 30 -b:v 0" }
+	};
+	for (size_t k = 0; k < sizeof(codecs) / sizeof(codecs[0]); k++)
+		if (fourcc == codecs[k][0])
+			return codecs[k][1];
+	return "";
+}
+
+// fps for ffmpeg's -r, as the NTSC rationals like 30000/1001 where it is one
+static std::string ffmpeg_rate(double fps)
+{
+	char rate[32];
+	const double ntsc = floor(fps * 1001 + 0.5);
+	if (fabs(fps - floor(fps + 0.5)) < 1e-3)
+		snprintf(rate, sizeof(rate), "%d", (int)floor(fps + 0.5));
+	else if (fabs(ntsc / 1001 - fps) < 1e-4 && (long long)ntsc % 1000 == 0)
+		snprintf(rate, sizeof(rate), "%lld/1001", (long long)ntsc);
+	else
+		snprintf(rate, sizeof(rate), "%.6f", fps);
+	return rate;
+}
+
+bool run_warp_ffmpeg(const WarpJob &job, PipelineStats &stats)
+{
+	clear_stats(stats);
+	if (!check_warp_job(job, true))
+		return false;
+	if (job.outputfps == 0)
+	{
+		fprintf(stderr, "Image sequence output is not supported through ffmpeg\n");
+		return false;
+	}
+	// only the size, rate and codec of the input, ffmpeg decodes it
+	VideoCapture cap;
+	WarpParams p;
+	if (!open_input(job, cap, p))
+		return false;
+	double fps = job.outputfps < 0 ? cap.get(CAP_PROP_FPS) : job.outputfps;
+	std::string fourcc = fourcc_string(output_fourcc(job, cap));
+	const double infps = cap.get(CAP_PROP_FPS);
+	cap.release();
+	std::string encoder = ffmpeg_encoder_args(fourcc);
+	if (encoder.empty())
+		fprintf(stderr, "No ffmpeg encoder known for fourcc %s, ffmpeg picks one for the output file\n", fourcc.c_str());
+
+	char geometry[64];
+	snprintf(geometry, sizeof(geometry), "-s %dx%d -r %s", p.outputsize.width, p.outputsize.height,
+		ffmpeg_rate(fps).c_str());
+	// ffmpeg seeks from the keyframe before the start and drops the frames up to it
+	char range[96] = "";
+	if (job.startframe > 0)
+		snprintf(range, sizeof(range), "-ss %.6f ", job.startframe / infps);
+	std::string limit;
+	if (job.endframe >= 0)
+		limit = "-frames:v " + std::to_string(range_frames(job)) + " ";
+	std::string decodecmd = "ffmpeg -v error -nostdin " + std::string(range) + "-i \"" + job.inputfile + "\" "
+		+ limit + "-f rawvideo -pix_fmt yuv420p -";
+	std::string encodecmd = "ffmpeg -v error -y -f rawvideo -pix_fmt yuv420p " + std::string(geometry)
+		+ " -i - " + encoder + " -pix_fmt yuv420p \"" + job.outputfile + "\"";
+
+	FILE *in = popen(decodecmd.c_str(), POPEN_READ);
+	if (!in)
+	{
+		fprintf(stderr, "Could not run %s\n", decodecmd.c_str());
+		return false;
+	}
+	FILE *out = popen(encodecmd.c_str(), POPEN_WRITE);
+	if (!out)
+	{
+		fprintf(stderr, "Could not run %s\n", encodecmd.c_str());
+		pclose(in);
+		return false;
+	}
+
+	bool ok = warp_yuv_stream(job, p, in, out, 0, stats);
+	if (pclose(in) != 0 || stats.frames == 0)
+	{
+		fprintf(stderr, "ffmpeg could not decode %s\n", job.inputfile.c_str());
+		ok = false;
+	}
+	// waits for the encoder to finish the file
+	int64 t0 = getTickCount();
+	if (pclose(out) != 0)
+	{
+		fprintf(stderr, "ffmpeg could not encode %s\n", job.outputfile.c_str());
+		ok = false;
+	}
+	stats.encodems += elapsed_ms(t0);
+	stats.wallms += elapsed_ms(t0);
+	return ok;
+}
+
+// nsegments + 1 frame indices splitting frames first .. last-1, segment s is
+// bounds[s] .. bounds[s+1]-1. Each start after the first is moved to the
+// keyframe nearest an even split, so that seeking there decodes nothing before it.
+static std::vector<long long> segment_bounds(long long first, long long last, int nsegments,
+	const std::vector<long long> &keys)
+{
+	std::vector<long long> bounds(1, first);
+	for (int s = 1; s < nsegments; s++)
+	{
+		long long b = first + (last - first) * s / nsegments;
+		if (!keys.empty())
+		{
+			std::vector<long long>::const_iterator k = std::lower_bound(keys.begin(), keys.end(), b);
+			if (k == keys.end() || (k != keys.begin() && b - *(k - 1) < *k - b))
+				--k;
+			b = *k;
+		}
+		// segments which fall on the same keyframe are merged
+		if (b > bounds.back() && b < last)
+			bounds.push_back(b);
+	}
+	bounds.push_back(last);
+	return bounds;
+}
+
+// out.mp4 -> out.part002.mp4
+static std::string segment_filename(const std::string &output, int s)
+{
+	size_t slash = output.find_last_of("/\\");
+	size_t dot = output.find_last_of('.');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		dot = output.size();
+	char part[32];
+	snprintf(part, sizeof(part), ".part%03d", s);
+	return output.substr(0, dot) + part + output.substr(dot);
+}
+
+bool run_warp_segments(const WarpJob &job, int nsegments, PipelineStats &stats)
+{
+	clear_stats(stats);
+	if (!check_warp_job(job))
+		return false;
+	if (job.outputfps == 0)
+	{
+		fprintf(stderr, "Image sequences are processed in parallel by batch, not segments\n");
+		return false;
+	}
+	if (is_raw_file(job.inputfile) || is_raw_file(job.outputfile))
+	{
+		fprintf(stderr, "Intermediate .ocvw files are not split into segments, use the pipeline\n");
+		return false;
+	}
+	VideoCapture cap;
+	WarpParams p;
+	if (!open_input(job, cap, p))
+		return false;
+	const long long count = (long long)cap.get(CAP_PROP_FRAME_COUNT);
+	const double fps = cap.get(CAP_PROP_FPS);
+	// once here, rather than in each segment
+	if (!check_output_codec(job, cap))
+		return false;
+	cap.release();
+	if (count <= 0 || fps <= 0)
+	{
+		fprintf(stderr, "Could not get the frame count of %s\n", job.inputfile.c_str());
+		return false;
+	}
+	if (nsegments < 1)
+		nsegments = 1;
+
+	// the range, the end as the frame count may be an estimate
+	const long long first = std::max(job.startframe, 0LL);
+	const long long last = job.endframe < 0 ? count : job.endframe;
+	if (last <= first)
+	{
+		fprintf(stderr, "No frames in the range %lld to %lld\n", job.startframe, job.endframe);
+		return false;
+	}
+	const std::vector<long long> keys = probe_keyframes(job.inputfile, fps);
+	const std::vector<long long> bounds = segment_bounds(first, last, nsegments, keys);
+	nsegments = (int)bounds.size() - 1;
+	const bool perframe = maps_per_frame(job);
+	FrameWarp fw;
+	if (!prepare_frame_warp(job, p, first, fw))
+		return false;
+
+	std::vector<PipelineStats> segstats(nsegments);
+	std::vector<char> segok(nsegments, 0);
+	std::atomic<long long> done(0);
+	std::atomic<int> running(nsegments);
+	std::atomic<bool> failed(false);
+
+	SingleThreadedOpenCV cvthreads;
+	printf("%d segments\n", nsegments);
+	int64 tstart = getTickCount();
+
+	// each segment has its own reader and writer, so the encoders run in parallel
+	std::vector<std::thread> workers;
+	for (int s = 0; s < nsegments; s++)
+	{
+		workers.push_back(std::thread([&, s]()
+		{
+			PipelineStats &ss = segstats[s];
+			clear_stats(ss);
+			WarpJob segjob = job;
+			segjob.outputfile = segment_filename(job.outputfile, s);
+			VideoCapture in;
+			VideoWriter out;
+			WarpParams q;
+			if (open_input(job, in, q) && open_writer(segjob, in, fps, out) && seek_frame(in, bounds[s], keys))
+			{
+				FrameWarp local;
+				Mat frame, dst;
+				// without an end frame the last segment runs to the end, the
+				// frame count may be an estimate
+				const long long end = s + 1 < nsegments || job.endframe >= 0 ? bounds[s + 1] : LLONG_MAX;
+				for (long long k = bounds[s]; k < end && !failed; k++)
+				{
+					int64 t0 = getTickCount();
+					bool got = in.read(frame);
+					ss.decodems += stage_ms(job.timing, STAGE_DECODE, t0);
+					if (!got)
+						break;
+
+					t0 = getTickCount();
+					const FrameWarp *m = &fw;
+					if (perframe)
+					{
+						if (!timed_prepare(job, p, k, local))
+						{
+							failed = true;
+							break;
+						}
+						m = &local;
+					}
+					timed_warp(job, frame, dst, *m);
+					ss.warpms += elapsed_ms(t0);
+
+					t0 = getTickCount();
+					out.write(dst);
+					ss.encodems += stage_ms(job.timing, STAGE_ENCODE, t0);
+					ss.frames++;
+					done++;
+				}
+				segok[s] = 1;
+			}
+			else
+				fprintf(stderr, "\nCould not start segment %d at frame %lld\n", s, bounds[s]);
+			running--;
+		}));
+	}
+
+	print_progress(running, done, last - first, tstart);
+	bool ok = true;
+	for (int s = 0; s < nsegments; s++)
+	{
+		workers[s].join();
+		stats.frames += segstats[s].frames;
+		stats.decodems += segstats[s].decodems;
+		stats.warpms += segstats[s].warpms;
+		stats.encodems += segstats[s].encodems;
+		ok = ok && segok[s];
+	}
+	printf("\n");
+	if (!ok || failed)
+		return false;
+
+	// stream copy of the segments into one file, no re-encoding
+	std::string listfile = job.outputfile + ".segments.txt";
+	FILE *list = fopen(listfile.c_str(), "w");
+	if (!list)
+	{
+		fprintf(stderr, "Could not write %s\n", listfile.c_str());
+		return false;
+	}
+	for (int s = 0; s < nsegments; s++)
+		fprintf(list, "file '%s'\n", segment_filename(job.outputfile, s).c_str());
+	fclose(list);
+	std::string cmd = "ffmpeg -v error -y -f concat -safe 0 -i \"" + listfile + "\" -c copy \"" + job.outputfile + "\"";
+	int64 t0 = getTickCount();
+	ok = system(cmd.c_str()) == 0;
+	stats.encodems += elapsed_ms(t0);
+	if (ok)
+	{
+		remove(listfile.c_str());
+		for (int s = 0; s < nsegments; s++)
+			remove(segment_filename(job.outputfile, s).c_str());
+	}
+	else
+		fprintf(stderr, "Could not join the segments, they are left as %s and so on\n",
+			segment_filename(job.outputfile, 0).c_str());
+	stats.wallms = elapsed_ms(tstart);
+	return ok;
+}
+
+void print_pipeline_stats(const PipelineStats &stats, FILE *out)
+{
+	double n = stats.frames > 0 ? (double)stats.frames : 1.0;
+	fprintf(out, "%lld frames in %.2f s, %.2f fps\n", stats.frames, stats.wallms / 1000.0,
+		stats.frames * 1000.0 / (stats.wallms > 0 ? stats.wallms : 1.0));
+	fprintf(out, "  decode %7.2f ms/frame, %5.1f%% busy, %7.2f ms/frame blocked, %lld buffer allocations\n",
+		stats.decodems / n, 100.0 * stats.decodems / stats.wallms, stats.decodewaitms / n, stats.decodeallocs);
+	fprintf(out, "  warp   %7.2f ms/frame (summed over workers)\n", stats.warpms / n);
+	fprintf(out, "  encode %7.2f ms/frame, %5.1f%% busy, %7.2f ms/frame waiting\n",
+		stats.encodems / n, 100.0 * stats.encodems / stats.wallms, stats.encodewaitms / n);
+	if (stats.encodedbytes > 0)
+		fprintf(out, "  wrote %.1f MB, %.1f MB/s of encoding\n", stats.encodedbytes / 1e6,
+			stats.encodedbytes / 1e3 / (stats.encodems > 0 ? stats.encodems : 1.0));
+	if (stats.encodefps > 0)
+		fprintf(out, "  encoder %.2f fps when busy, reorder queue %.1f frames mean, %zu most\n",
+			stats.encodefps, stats.meanreorder, stats.maxreorder);
+}
@@ -0,0 +1,415 @@
+#ifndef OCVWARPPIPELINE_H
+#define OCVWARPPIPELINE_H
+
+/*
+ * Frame pipeline for OCVWarp - decode, warp and encode on separate threads.
+ *
+ */
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <opencv2/opencv.hpp>
+
+#include "ocvwarpmaps.h"
+#include "ocvwarpremap.h"
+#include "ocvwarpraw.h"
+#include "ocvwarptiming.h"
+
+// interpolation profiles, quality against speed
+enum
+{
+	PROFILE_PREVIEW = 0,	// nearest neighbour, fixed point maps
+	PROFILE_STANDARD = 1,	// bilinear
+	PROFILE_MASTER = 2	// Lanczos, mip sampling where minified, antialiased picture edge
+};
+
+// PROFILE_... for preview, standard or master, -1 if none of those
+int interpolation_profile(const std::string &name);
+const char *profile_name(int profile);
+
+// the settings in OCVWarp.ini, plus the files to work on
+struct WarpJob
+{
+	WarpParams params;	// inputsize is filled in from the input file
+	float anglexincr;	// degrees per frame
+	float angleyincr;
+	std::string fourcc;	// NULL for same as input, see build/fourcc.txt
+	int outputfps;		// -1 = same as input, 0 = image sequence
+	std::string inputfile;
+	std::string outputfile;
+	bool blend;		// apply the mesh intensity column, transformtype 4 & 5
+	float gamma;		// 1 scales pixel values, else blend in linear light with this gamma
+	bool meshwarp;		// transformtype 4 straight from the mesh, no full size maps
+	bool planar;		// remap split colour planes, interleaved again for the encoder
+	bool mip;		// sample minified areas from a mip pyramid, see MipRemap
+	bool stream;		// warp in bands of rows with band maps, see StreamingRemap
+	int profile;		// PROFILE_..., optional 11th value of the ini. Only standard with
+				// blend, mip, planar, meshwarp, stream and the YUV paths, which the runs check
+	int compression;	// image sequence output, see sequence_write_params, -1 for OpenCV's default
+	long long startframe;	// input frames startframe .. endframe-1 are warped,
+	long long endframe;	// -1 for to the end. Angle increments count from input frame 0.
+	StageTimes *timing;	// per frame stage times are added here, 0 for none
+};
+
+// the maps for one frame, plus what the remap engine precomputes from them
+struct FrameWarp
+{
+	WarpMaps maps;
+	bool blend;
+	GainRemap gainplan;
+	bool usemesh;
+	MeshWarp meshplan;
+	bool planar;
+	PlanarRemap planarplan;
+	bool mip;
+	MipRemap mipplan;
+	bool stream;		// no full size maps, maps is empty
+	StreamingRemap streamplan;
+	int profile;
+	cv::Mat nearest;	// PROFILE_PREVIEW, CV_16SC2 integer map
+	cv::Mat minified;	// PROFILE_MASTER, CV_8U mask of the pixels taken from mipplan
+	std::vector<cv::Point> edgepixels;	// PROFILE_MASTER, partly covered output pixels
+	std::vector<float> edgecoverage;
+	cv::Mat edgesource;	// CV_32FC2 map, the centroids of the edge pixels' covered subsamples, in order
+};
+
+// frame as CV_8UC3 for the remap engines, converting grey, BGRA and 16 bit
+// frames only within maps.srcbands - the rest of src is never read by a
+// bilinear remap and is left as it was. CV_8UC3 frames are used as they are.
+void convert_source(const cv::Mat &frame, cv::Mat &src, const WarpMaps &maps);
+// the same for the way fw warps - the bands only allow for bilinear taps, so
+// with fw.mip or the master profile the whole frame is converted, as the mip
+// pyramid downsamples whole tiles and Lanczos reads 4 pixels either side
+void convert_source(const cv::Mat &frame, cv::Mat &src, const FrameWarp &fw);
+
+// reads OCVWarp.ini - a comment line starting with # above each value.
+// The interpolation profile after Output_fps may be left out, for standard.
+bool read_ocvwarp_ini(const std::string &path, WarpJob &job);
+
+// the maps for frame index of the job, plus what the remap engine
+// precomputes from them. p is job.params with the input size filled in.
+bool prepare_frame_warp(const WarpJob &job, const WarpParams &p, long long index, FrameWarp &fw);
+// src is CV_8UC3
+void apply_frame_warp(const cv::Mat &src, cv::Mat &dst, const FrameWarp &fw);
+
+struct PipelineStats
+{
+	long long frames;
+	double wallms;
+	double decodems;	// busy time per stage, summed over threads
+	double warpms;
+	double encodems;
+	double decodewaitms;	// decoder blocked by back-pressure
+	double encodewaitms;	// encoder waiting for the next frame in order
+	long long decodeallocs;	// times a decoded frame needed a new buffer
+	double encodefps;	// frames per second of encoder busy time
+	size_t maxreorder;	// most frames waiting to be written in order
+	double meanreorder;
+	long long encodedbytes;	// image files written, 0 for video
+};
+
+// the inherited OCVWarp loop - read, warp, write, one frame at a time on
+// the calling thread, the baseline for the other runs
+bool run_warp_sequential(const WarpJob &job, PipelineStats &stats);
+
+// the same loop with one warp thread, but decoding the next frames and
+// encoding the last ones on their own threads while a frame is warped
+bool run_warp_overlapped(const WarpJob &job, PipelineStats &stats);
+
+// The video runs take job.startframe .. endframe, seeking to the keyframe
+// before the start and decoding forward from there. Output frames are
+// numbered from the start. run_warp_sequential, run_warp_overlapped and
+// run_warp_pipeline also read and write intermediate files (.ocvw, see
+// ocvwarpraw.h), compressed if job.compression is set.
+
+// decode thread -> nworkers warp threads -> encode thread, see AsyncFrameReader
+// and AsyncFrameWriter. At most 2 * nworkers + 2 warped frames wait to be
+// written in input order.
+bool run_warp_pipeline(const WarpJob &job, int nworkers, PipelineStats &stats);
+
+// image sequences - inputfile and outputfile are printf style patterns like
+// in%05d.png. The frames are split into nworkers contiguous shards, each
+// worker reads, warps and writes its own shard, sharing one set of maps.
+// Output frames are numbered from 0 at the first input file, like OpenCV's
+// image sequence writer, and a frame range keeps that numbering.
+bool run_sequence_batch(const WarpJob &job, int nworkers, PipelineStats &stats);
+
+// index of the first existing file of a printf style pattern, searched from 0,
+// and the number of consecutive files from there, -1 if none are found
+long long find_sequence_start(const std::string &pattern, long long &count);
+// true if pattern has exactly one %d style conversion and no others but %%,
+// which sequence_filename needs
+bool is_sequence_pattern(const std::string &pattern);
+std::string sequence_filename(const std::string &pattern, long long index);
+
+// WarpJob::compression for lossless output tuned for speed, not size -
+// PNG at zlib level 1, TIFF with PackBits
+enum { COMPRESSION_FAST = -2 };
+
+// cv::imwrite parameters for the files of pattern by its extension.
+// level is the zlib level 0-9 for PNG, the quality 0-100 for JPEG and WebP,
+// and the IMWRITE_TIFF_COMPRESSION scheme for TIFF, or COMPRESSION_FAST.
+// -1 gives no parameters.
+std::vector<int> sequence_write_params(const std::string &pattern, int level);
+
+// image sequences through SequenceReader and SequenceWriter - ncodecs threads
+// decoding, nworkers warping and ncodecs encoding, with the frames in order
+bool run_sequence_pipeline(const WarpJob &job, int nworkers, int ncodecs, PipelineStats &stats);
+
+// raw I420 frames of inputsize from inputfile to outputfile, - for stdin / stdout,
+// remapped in YUV so that ffmpeg can decode and encode around it without any
+// BGR conversion, e.g. ffmpeg -i in.mp4 -f rawvideo -pix_fmt yuv420p -
+bool run_warp_yuv(const WarpJob &job, cv::Size inputsize, PipelineStats &stats);
+
+// ffmpeg encoder options for a fourcc of build/fourcc.txt, like "-c:v libx264",
+// empty if not known, then ffmpeg picks the encoder from the output extension
+std::string ffmpeg_encoder_args(const std::string &fourcc);
+
+// video through ffmpeg child processes (ffmpeg on the PATH) instead of
+// VideoCapture / VideoWriter. The decoder's I420 planes go straight into
+// yuv_remap and the remapped planes straight to the encoder, with no BGR
+// conversion either side and no frame allocated per frame. The encoder comes
+// from the ini fourcc, or the input's for NULL. Video output only.
+bool run_warp_ffmpeg(const WarpJob &job, PipelineStats &stats);
+
+// Video in nsegments pieces warped and encoded at the same time, each by its
+// own thread with its own reader and writer, then joined into outputfile with
+// ffmpeg's concat demuxer without re-encoding. Segments start on input
+// keyframes (found with ffprobe, if there) near an even split, so no segment
+// decodes frames it does not write. Video output only.
+bool run_warp_segments(const WarpJob &job, int nsegments, PipelineStats &stats);
+
+void print_pipeline_stats(const PipelineStats &stats, FILE *out = stdout);
+
+// blocking FIFO with a fixed capacity, push waits while full, pop waits while empty
+template<typename T> class BoundedQueue
+{
+public:
+	BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+	// false if the queue was closed
+	bool push(const T &item)
+	{
+		std::unique_lock<std::mutex> lock(m);
+		notfull.wait(lock, [this]() { return q.size() < capacity || closed; });
+		if (closed)
+			return false;
+		q.push_back(item);
+		notempty.notify_one();
+		return true;
+	}
+
+	// false once the queue is closed and empty
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(m);
+		notempty.wait(lock, [this]() { return !q.empty() || closed; });
+		if (q.empty())
+			return false;
+		item = q.front();
+		q.pop_front();
+		notfull.notify_one();
+		return true;
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		closed = true;
+		notempty.notify_all();
+		notfull.notify_all();
+	}
+
+	// empty and open again, with a new capacity
+	void reset(size_t newcapacity)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		q.clear();
+		capacity = newcapacity;
+		closed = false;
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		return q.size();
+	}
+
+private:
+	size_t capacity;
+	bool closed;
+	std::deque<T> q;
+	std::mutex m;
+	std::condition_variable notempty, notfull;
+};
+
+// a decoded frame from AsyncFrameReader - frame is one of the reader's
+// buffers, only valid until it is given back with recycle()
+struct PooledFrame
+{
+	long long index;
+	int slot;
+	cv::Mat frame;
+};
+
+// Decodes ahead on its own thread into a ring of frame buffers which are
+// reused, so that neither decoding nor allocating lands on the warp threads.
+// Open the input with capture(), then start(). next() may be called from
+// any number of threads.
+class AsyncFrameReader
+{
+public:
+	AsyncFrameReader();
+	~AsyncFrameReader();
+
+	// only to be used before start(). Either open capture(), or an
+	// intermediate file with raw().
+	cv::VideoCapture &capture() { return cap; }
+	RawFrameReader &raw() { return file; }
+	double fps();
+	// decodes count frames (-1 for all), indexed from first - seek to it first
+	void start(int poolsize = 4, long long first = 0, long long count = -1);
+	// decodes frame index into frame on the calling thread, instead of start()
+	// and next(). False at the end.
+	bool read(long long index, cv::Mat &frame);
+
+	// the next decoded frame, waits only if none is ready. False at the end.
+	bool next(PooledFrame &f);
+	// f's buffer can be decoded into again
+	void recycle(const PooledFrame &f);
+	void close();
+
+	double decodems;	// busy decoding
+	double waitms;		// waiting for a buffer to be recycled
+	long long allocations;	// decodes which needed a new buffer, poolsize once the ring is full
+	StageTimes *timing;	// 0 unless set before start()
+
+private:
+	cv::VideoCapture cap;
+	RawFrameReader file;
+	std::vector<cv::Mat> pool;
+	BoundedQueue<int> freeslots;
+	BoundedQueue<PooledFrame> ready;
+	std::thread decoder;
+};
+
+// Encodes on its own thread. Frames may be handed over in any order from any
+// thread and are written in index order from 0. A frame more than window
+// frames ahead of the next one to write waits, so at most window frames are
+// held. Open the writer with writer(), then start().
+class AsyncFrameWriter
+{
+public:
+	AsyncFrameWriter();
+	~AsyncFrameWriter();
+
+	// only to be used before start(). Either open writer() or raw(), or give an
+	// image sequence pattern, written with the params through a reused encode buffer.
+	cv::VideoWriter &writer() { return out; }
+	RawFrameWriter &raw() { return file; }
+	void sequence(const std::string &pattern, const std::vector<int> &params);
+	void start(size_t window);
+
+	// frame must not be changed afterwards, it is written later
+	void write(long long index, const cv::Mat &frame);
+	// writes frame now on the calling thread, instead of start() and write()
+	void encode(long long index, const cv::Mat &frame);
+	// writes the rest in order and stops, frames missing from the order are skipped
+	void finish();
+	// stops without writing the rest, for a run that failed. Any thread may
+	// call it, write() no longer waits and finish() is still needed.
+	void cancel();
+
+	long long written;
+	double encodems;	// busy encoding
+	double idlems;		// waiting for the next frame in order
+	size_t maxdepth;	// frames held for reordering, most and mean over write() calls
+	double meandepth;
+	long long bytes;	// image sequence or intermediate file bytes written
+	StageTimes *timing;	// 0 unless set before start()
+
+private:
+	cv::VideoWriter out;
+	RawFrameWriter file;
+	std::string pattern;
+	std::vector<int> params;
+	std::vector<cv::uchar> buffer;
+	size_t window;
+	std::map<long long, cv::Mat> pending;
+	long long nextindex;
+	bool finishing;
+	bool cancelled;
+	double depthsum;
+	long long depthcount;
+	std::mutex m;
+	std::condition_variable arrived, advanced;
+	std::thread encoder;
+};
+
+// Reads an image sequence with ndecoders threads decoding files at the same
+// time, at most readahead frames ahead of the one next() is waiting for.
+// next() gives the frames in order and may be called from any thread.
+class SequenceReader
+{
+public:
+	SequenceReader(const std::string &pattern, long long first, long long count,
+		int ndecoders, int readahead, StageTimes *timing = 0);
+	~SequenceReader();
+
+	// index from 0, frame as read (IMREAD_UNCHANGED), empty if the file
+	// could not be read. False at the end.
+	bool next(long long &index, cv::Mat &frame);
+	void close();
+
+	double decodems;	// busy decoding, summed over the decoders
+	StageTimes *timing;
+
+private:
+	std::string pattern;
+	long long first, count;
+	int readahead;
+	long long nextread;	// next index to give a decoder
+	long long nextout;	// next index for next()
+	bool closed;
+	std::map<long long, cv::Mat> decoded;
+	std::mutex m;
+	std::condition_variable changed;
+	std::vector<std::thread> decoders;
+};
+
+// Writes an image sequence with nencoders threads encoding files at the same
+// time. write() may be called from any thread in any order, each frame goes to
+// its own numbered file, so the order is kept. write() waits while
+// 2 * nencoders frames are queued.
+class SequenceWriter
+{
+public:
+	SequenceWriter(const std::string &pattern, int nencoders, const std::vector<int> &params,
+		StageTimes *timing = 0);
+	~SequenceWriter();
+
+	// frame must not be changed afterwards
+	void write(long long index, const cv::Mat &frame);
+	// waits for all the queued frames, false if any could not be written
+	bool finish();
+
+	double encodems;	// busy encoding, summed over the encoders
+	long long bytes;	// written
+	StageTimes *timing;
+
+private:
+	std::string pattern;
+	std::vector<int> params;
+	BoundedQueue<std::pair<long long, cv::Mat> > queue;
+	std::vector<std::thread> encoders;
+	std::mutex m;
+	bool failed;
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Interactive preview for OCVWarp. See ocvwarppreview.h
+ *
+ */
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "ocvwarppreview.h"
+
+using namespace cv;
+
+ProgressiveWarp::ProgressiveWarp(const WarpParams &p, int coarsest)
+	: params(p), meshok(true), coarsest(coarsest), scaling(coarsest), rowsdone(0), scalems(0),
+	changed(getTickCount()), shownscale(0), lastms(0)
+{
+	if (p.transformtype == 4 || p.transformtype == 5)
+		meshok = read_mesh_file(p.mapfile, mesh);
+	if (!meshok)
+		fprintf(stderr, "Could not read map file %s\n", p.mapfile.c_str());
+}
+
+void ProgressiveWarp::set_angles(float anglex, float angley)
+{
+	if (anglex == params.anglex && angley == params.angley)
+		return;
+	params.anglex = anglex;
+	params.angley = angley;
+	scaling = coarsest;
+	rowsdone = 0;
+	scalems = 0;
+	changed = getTickCount();
+}
+
+bool ProgressiveWarp::step(const Mat &src, double budgetms, double settlems)
+{
+	if (!meshok || scaling == 0)
+		return false;
+	const double tickms = 1000.0 / getTickFrequency();
+	if (rowsdone == 0 && scaling < coarsest && (getTickCount() - changed) * tickms < settlems)
+		return false;
+
+	// maps made straight at the reduced size, a band of rows at a time
+	WarpParams q = params;
+	q.inputsize = src.size();
+	q.outputsize = Size(std::max(params.outputsize.width / scaling, 2), std::max(params.outputsize.height / scaling, 2));
+	if (rowsdone == 0)
+		current.create(q.outputsize, src.type());
+	const int bandrows = 32;
+	int64 t0 = getTickCount();
+	Mat map_x, map_y, gain;
+	while (rowsdone < q.outputsize.height)
+	{
+		const int y1 = std::min(rowsdone + bandrows, q.outputsize.height);
+		if (!build_band_maps(q, mesh, Range(rowsdone, y1), map_x, map_y, gain))
+		{
+			meshok = false;
+			return false;
+		}
+		Mat band = current.rowRange(rowsdone, y1);
+		remap(src, band, map_x, map_y, INTER_LINEAR, BORDER_CONSTANT, Scalar(0, 0, 0));
+		rowsdone = y1;
+		// the coarsest size is always finished, so there is something to show
+		if (scaling < coarsest && (getTickCount() - t0) * tickms > budgetms)
+			break;
+	}
+	scalems += (getTickCount() - t0) * tickms;
+	if (rowsdone < q.outputsize.height)
+		return false;
+
+	current.copyTo(shown);
+	shownscale = scaling;
+	lastms = scalems;
+	scaling /= 2;
+	rowsdone = 0;
+	scalems = 0;
+	return true;
+}
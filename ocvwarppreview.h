@@ -0,0 +1,50 @@
+#ifndef OCVWARPPREVIEW_H
+#define OCVWARPPREVIEW_H
+
+/*
+ * Interactive preview for OCVWarp - while AngleX / AngleY are being changed
+ * the warp is rendered at a fraction of the output size, then refined step
+ * by step up to full size once they stop changing.
+ *
+ */
+
+#include <opencv2/opencv.hpp>
+
+#include "ocvwarpmaps.h"
+
+class ProgressiveWarp
+{
+public:
+	// p.outputsize is the full size, coarsest the largest divisor used
+	ProgressiveWarp(const WarpParams &p, int coarsest = 4);
+	bool ok() const { return meshok; }
+
+	// starts again from the coarsest size if the angles are different
+	void set_angles(float anglex, float angley);
+
+	// renders bands of rows of the current size until budgetms is used up,
+	// moving to the next finer size once a size is complete and the angles
+	// have not changed for settlems. True if image() changed.
+	bool step(const cv::Mat &src, double budgetms, double settlems = 250);
+
+	// the latest complete render, at full size / scale()
+	const cv::Mat &image() const { return shown; }
+	int scale() const { return shownscale; }
+	bool done() const { return shownscale == 1; }
+	double render_ms() const { return lastms; }	// time the shown render took
+
+private:
+	WarpParams params;
+	WarpMesh mesh;
+	bool meshok;
+	int coarsest;
+	int scaling;		// divisor being rendered, 0 once at full size
+	int rowsdone;
+	double scalems;		// time spent on the render in progress
+	long long changed;	// tick count of the last angle change
+	cv::Mat current, shown;
+	int shownscale;
+	double lastms;
+};
+
+#endif
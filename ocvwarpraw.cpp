@@ -0,0 +1,300 @@
+/*
+ * Lossless intermediate files for OCVWarp. See ocvwarpraw.h
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
+
+#include "ocvwarpraw.h"
+
+using namespace cv;
+
+static const char magic[8] = { 'O', 'C', 'V', 'W', 'R', 'A', 'W', '1' };
+static const long long headerbytes = 64;
+static const long long alignment = 4096;
+
+// as written, after the magic
+struct RawHeader
+{
+	int32_t width, height, channels, level;
+	double fps;
+	int64_t frames, indexoffset;
+};
+
+bool is_raw_file(const std::string &name)
+{
+	return name.size() > 5 && name.compare(name.size() - 5, 5, ".ocvw") == 0;
+}
+
+RawFrameWriter::RawFrameWriter()
+	: bytes(0), f(0), channels(0), fps(0), level(-1), offset(0), failed(false)
+{
+}
+
+RawFrameWriter::~RawFrameWriter()
+{
+	close();
+}
+
+bool RawFrameWriter::pad_to(long long to)
+{
+	static const char zeros[alignment] = { 0 };
+	while (offset < to)
+	{
+		size_t n = (size_t)std::min(to - offset, alignment);
+		if (fwrite(zeros, 1, n, f) != n)
+			return false;
+		offset += n;
+	}
+	return true;
+}
+
+bool RawFrameWriter::open(const std::string &name, Size framesize, int type, double framerate, int pnglevel)
+{
+	close();
+	if (CV_MAT_DEPTH(type) != CV_8U)
+		return false;
+	f = fopen(name.c_str(), "wb");
+	if (!f)
+		return false;
+	size = framesize;
+	channels = CV_MAT_CN(type);
+	fps = framerate;
+	level = pnglevel < 0 ? -1 : std::min(pnglevel, 9);
+	offset = 0;
+	bytes = 0;
+	failed = false;
+	index.clear();
+	// the header is written again by close, with the index
+	return pad_to(headerbytes);
+}
+
+bool RawFrameWriter::write(const Mat &frame)
+{
+	if (!f || frame.size() != size || frame.type() != CV_MAKETYPE(CV_8U, channels))
+	{
+		failed = true;
+		return false;
+	}
+	if (!pad_to((offset + alignment - 1) / alignment * alignment))
+	{
+		failed = true;
+		return false;
+	}
+	const long long start = offset;
+	bool ok = true;
+	if (level >= 0)
+	{
+		std::vector<int> params;
+		params.push_back(IMWRITE_PNG_COMPRESSION);
+		params.push_back(level);
+		ok = imencode(".png", frame, buffer, params)
+			&& fwrite(buffer.data(), 1, buffer.size(), f) == buffer.size();
+		offset += buffer.size();
+	}
+	else
+	{
+		if (channels == 1)
+			planes.assign(1, frame);
+		else
+			split(frame, planes);
+		for (size_t c = 0; c < planes.size() && ok; c++)
+		{
+			for (int y = 0; y < size.height && ok; y++)
+				ok = fwrite(planes[c].ptr(y), 1, size.width, f) == (size_t)size.width;
+			offset += (long long)size.width * size.height;
+		}
+	}
+	if (!ok)
+	{
+		failed = true;
+		return false;
+	}
+	index.push_back(start);
+	index.push_back(offset - start);
+	bytes += offset - start;
+	return true;
+}
+
+bool RawFrameWriter::close()
+{
+	if (!f)
+		return !failed;
+	RawHeader h;
+	h.width = size.width;
+	h.height = size.height;
+	h.channels = channels;
+	h.level = level;
+	h.fps = fps;
+	h.frames = index.size() / 2;
+	h.indexoffset = offset;
+	bool ok = !failed;
+	for (size_t k = 0; k < index.size() && ok; k++)
+	{
+		int64_t v = index[k];
+		ok = fwrite(&v, sizeof(v), 1, f) == 1;
+	}
+	ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(magic, 1, sizeof(magic), f) == sizeof(magic)
+		&& fwrite(&h, sizeof(h), 1, f) == 1;
+	ok = fclose(f) == 0 && ok;
+	f = 0;
+	failed = !ok;
+	return ok;
+}
+
+RawFrameReader::RawFrameReader()
+	: channels(0), rate(0), level(-1), mapped(0), mappedsize(0), f(0)
+{
+}
+
+RawFrameReader::~RawFrameReader()
+{
+	close();
+}
+
+void RawFrameReader::close()
+{
+#ifndef _WIN32
+	if (mapped)
+		munmap((void *)mapped, mappedsize);
+#endif
+	mapped = 0;
+	mappedsize = 0;
+	if (f)
+		fclose(f);
+	f = 0;
+	index.clear();
+}
+
+bool RawFrameReader::open(const std::string &name)
+{
+	close();
+	char m[sizeof(magic)];
+	RawHeader h;
+#ifndef _WIN32
+	int fd = ::open(name.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size >= headerbytes)
+	{
+		void *p = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p != MAP_FAILED)
+		{
+			mapped = (const uchar *)p;
+			mappedsize = (size_t)st.st_size;
+		}
+	}
+	::close(fd);
+	if (!mapped)
+		return false;
+	memcpy(m, mapped, sizeof(m));
+	memcpy(&h, mapped + sizeof(m), sizeof(h));
+#else
+	f = fopen(name.c_str(), "rb");
+	if (!f || fread(m, 1, sizeof(m), f) != sizeof(m) || fread(&h, sizeof(h), 1, f) != 1)
+	{
+		close();
+		return false;
+	}
+#endif
+	if (memcmp(m, magic, sizeof(magic)) != 0 || h.width <= 0 || h.height <= 0
+		|| h.channels < 1 || h.channels > 4 || h.frames < 0 || h.indexoffset < headerbytes)
+	{
+		close();
+		return false;
+	}
+	framesize = Size(h.width, h.height);
+	channels = h.channels;
+	rate = h.fps;
+	level = h.level;
+
+	// the index has to be in the file before it is allocated, a damaged
+	// header could ask for any amount
+	long long filesize = (long long)mappedsize;
+	if (!mapped)
+		filesize = fseek64(f, 0, SEEK_END) == 0 ? (long long)ftell64(f) : -1;
+	if (h.indexoffset > filesize || h.frames > (filesize - h.indexoffset) / (2 * (long long)sizeof(int64_t)))
+	{
+		close();
+		return false;
+	}
+	index.resize(2 * h.frames);
+	bool ok;
+	if (mapped)
+	{
+		ok = true;
+		for (size_t k = 0; k < index.size() && ok; k++)
+		{
+			int64_t v;
+			memcpy(&v, mapped + h.indexoffset + k * sizeof(v), sizeof(v));
+			index[k] = v;
+		}
+	}
+	else
+	{
+		ok = fseek64(f, h.indexoffset, SEEK_SET) == 0;
+		for (size_t k = 0; k < index.size() && ok; k++)
+		{
+			int64_t v;
+			ok = fread(&v, sizeof(v), 1, f) == 1;
+			index[k] = v;
+		}
+	}
+	if (!ok)
+		close();
+	return ok;
+}
+
+const uchar *RawFrameReader::frame_data(long long k, std::vector<uchar> &buf)
+{
+	if (k < 0 || k >= frames())
+		return 0;
+	const long long start = index[2 * k], n = index[2 * k + 1];
+	if (start < headerbytes || n < 0)
+		return 0;
+	if (mapped)
+		return (size_t)(start + n) <= mappedsize ? mapped + start : 0;
+	buf.resize((size_t)n);
+	if (fseek64(f, start, SEEK_SET) != 0 || fread(buf.data(), 1, buf.size(), f) != buf.size())
+		return 0;
+	return buf.data();
+}
+
+bool RawFrameReader::read(long long k, Mat &frame)
+{
+	const uchar *data = frame_data(k, buffer);
+	if (!data)
+		return false;
+	if (level >= 0)
+	{
+		Mat png(1, (int)index[2 * k + 1], CV_8U, (void *)data);
+		imdecode(png, IMREAD_UNCHANGED, &frame);
+		return frame.size() == framesize && frame.channels() == channels;
+	}
+	const size_t planebytes = (size_t)framesize.width * framesize.height;
+	if (channels == 1)
+	{
+		Mat(framesize, CV_8UC1, (void *)data).copyTo(frame);
+		return true;
+	}
+	planes.resize(channels);
+	for (int c = 0; c < channels; c++)
+		planes[c] = Mat(framesize, CV_8UC1, (void *)(data + c * planebytes));
+	merge(planes, frame);
+	return true;
+}
@@ -0,0 +1,92 @@
+#ifndef OCVWARPRAW_H
+#define OCVWARPRAW_H
+
+/*
+ * Lossless intermediate files for OCVWarp (.ocvw), for multi-pass jobs like
+ * transformtype 1 then 4, instead of a lossy codec between the passes.
+ *
+ * A 64 byte header, then the frames, each starting on a 4096 byte boundary,
+ * then an index of (offset, bytes) per frame, all in the native byte order
+ * of the writer (little endian on the platforms OCVWarp runs on). A frame is
+ * either the colour planes one after another, uncompressed, which a reader
+ * interleaves straight from the memory mapped file, or a PNG of the
+ * interleaved frame at a fast zlib level.
+ *
+ */
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// true for names ending in .ocvw
+bool is_raw_file(const std::string &name);
+
+class RawFrameWriter
+{
+public:
+	RawFrameWriter();
+	~RawFrameWriter();
+
+	// CV_8UC1, CV_8UC3 or CV_8UC4 frames of size. level is the PNG zlib
+	// level 0-9, or -1 for uncompressed planes.
+	bool open(const std::string &name, cv::Size size, int type, double fps, int level = -1);
+	bool is_open() const { return f != 0; }
+	bool write(const cv::Mat &frame);
+	// writes the index and the header, false if anything could not be written
+	bool close();
+
+	long long bytes;	// frame data written
+
+private:
+	bool pad_to(long long offset);
+
+	FILE *f;
+	cv::Size size;
+	int channels;
+	double fps;
+	int level;
+	long long offset;
+	bool failed;
+	std::vector<long long> index;		// offset, bytes per frame
+	std::vector<cv::uchar> buffer;
+	std::vector<cv::Mat> planes;
+};
+
+// Random access to the frames of an intermediate file, from one thread at a
+// time. Memory mapped where the platform allows, read with stdio otherwise.
+class RawFrameReader
+{
+public:
+	RawFrameReader();
+	~RawFrameReader();
+
+	bool open(const std::string &name);
+	bool is_open() const { return mapped || f; }
+	void close();
+
+	cv::Size size() const { return framesize; }
+	int type() const { return CV_MAKETYPE(CV_8U, channels); }
+	double fps() const { return rate; }
+	long long frames() const { return (long long)index.size() / 2; }
+
+	// frame k interleaved, frame is reused if the size and type match
+	bool read(long long k, cv::Mat &frame);
+
+private:
+	// the bytes of frame k, from the mapping or read into buffer
+	const cv::uchar *frame_data(long long k, std::vector<cv::uchar> &buffer);
+
+	cv::Size framesize;
+	int channels;
+	double rate;
+	int level;
+	std::vector<long long> index;
+	const cv::uchar *mapped;	// whole file, 0 if not mapped
+	size_t mappedsize;
+	FILE *f;			// when not mapped
+	std::vector<cv::uchar> buffer;
+	std::vector<cv::Mat> planes;
+};
+
+#endif
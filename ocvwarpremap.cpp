@@ -0,0 +1,983 @@
+/*
+ * Remap engines for OCVWarp. See ocvwarpremap.h
+ *
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <algorithm>
+
+#include "ocvwarpremap.h"
+
+using namespace cv;
+
+void plan_tiled_remap(const Mat &map_x, const Mat &map_y, Size srcsize,
+	TiledRemap &plan, Size tilesize, Size binsize)
+{
+	CV_Assert(map_x.type() == CV_32F && map_y.type() == CV_32F && map_x.size() == map_y.size());
+	plan.srcsize = srcsize;
+	plan.dstsize = map_x.size();
+	plan.tilesize = tilesize;
+	plan.binsize = binsize;
+	convertMaps(map_x, map_y, plan.map1, plan.map2, CV_16SC2, false);
+
+	const int ntx = (plan.dstsize.width + tilesize.width - 1) / tilesize.width;
+	const int nty = (plan.dstsize.height + tilesize.height - 1) / tilesize.height;
+	const int nbx = (srcsize.width + binsize.width - 1) / binsize.width;
+	std::vector<Rect> tiles(ntx * nty), boxes(ntx * nty);
+	std::vector<int> keys(ntx * nty);
+
+	parallel_for_(Range(0, nty), [&](const Range &r)
+	{
+		for (int ty = r.start; ty < r.end; ty++)
+		{
+			for (int tx = 0; tx < ntx; tx++)
+			{
+				int t = ty * ntx + tx;
+				tiles[t] = Rect(tx * tilesize.width, ty * tilesize.height, tilesize.width, tilesize.height)
+					& Rect(Point(0, 0), plan.dstsize);
+				boxes[t] = source_box(map_x, map_y, tiles[t], srcsize);
+				if (boxes[t].empty())
+				{
+					// tiles without source just get cleared, do them first
+					keys[t] = -1;
+					continue;
+				}
+				int bx = (boxes[t].x + boxes[t].width / 2) / binsize.width;
+				int by = (boxes[t].y + boxes[t].height / 2) / binsize.height;
+				// serpentine order, so that neighbouring bins share source lines
+				if (by & 1)
+					bx = nbx - 1 - bx;
+				keys[t] = by * nbx + bx;
+			}
+		}
+	});
+
+	std::vector<int> order(tiles.size());
+	for (size_t t = 0; t < order.size(); t++)
+		order[t] = (int)t;
+	// stable, so tiles within a bin stay in output raster order
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return keys[a] < keys[b]; });
+
+	plan.dsttiles.resize(order.size());
+	plan.srcboxes.resize(order.size());
+	plan.binstart.clear();
+	for (size_t k = 0; k < order.size(); k++)
+	{
+		plan.dsttiles[k] = tiles[order[k]];
+		plan.srcboxes[k] = boxes[order[k]];
+		if (k == 0 || keys[order[k]] != keys[order[k - 1]])
+			plan.binstart.push_back((int)k);
+	}
+	plan.binstart.push_back((int)order.size());
+}
+
+void tiled_remap(const Mat &src, Mat &dst, const TiledRemap &plan, int interpolation)
+{
+	CV_Assert(src.size() == plan.srcsize);
+	dst.create(plan.dstsize, src.type());
+	const int nbins = (int)plan.binstart.size() - 1;
+
+	parallel_for_(Range(0, nbins), [&](const Range &r)
+	{
+		for (int b = r.start; b < r.end; b++)
+		{
+			for (int t = plan.binstart[b]; t < plan.binstart[b + 1]; t++)
+			{
+				const Rect &tile = plan.dsttiles[t];
+				Mat d = dst(tile);
+				if (plan.srcboxes[t].empty())
+				{
+					d.setTo(Scalar::all(0));
+					continue;
+				}
+				// d already has the tile's size and type, so remap writes in place
+				remap(src, d, plan.map1(tile), plan.map2(tile), interpolation, BORDER_CONSTANT, Scalar::all(0));
+			}
+		}
+	});
+}
+
+void plan_gain_remap(const Mat &map_x, const Mat &map_y, const Mat &gain,
+	Size srcsize, float gamma, GainRemap &plan)
+{
+	CV_Assert(map_x.type() == CV_32F && map_y.type() == CV_32F && gain.type() == CV_32F);
+	CV_Assert(map_x.size() == map_y.size() && map_x.size() == gain.size());
+	plan.srcsize = srcsize;
+	plan.gain = gain;
+	plan.gamma = gamma;
+	convertMaps(map_x, map_y, plan.map1, plan.map2, CV_16SC2, false);
+
+	plan.spans.clear();
+	plan.rowstart.assign(1, 0);
+	for (int j = 0; j < map_x.rows; j++)
+	{
+		const float *mx = map_x.ptr<float>(j);
+		const float *my = map_y.ptr<float>(j);
+		const float *g = gain.ptr<float>(j);
+		GainSpan span;
+		span.start = 0;
+		span.kind = -1;
+		for (int i = 0; i < map_x.cols; i++)
+		{
+			int kind;
+			if (mx[i] <= -1 || my[i] <= -1 || mx[i] >= srcsize.width || my[i] >= srcsize.height || g[i] <= 0)
+				kind = GAINSPAN_NOSOURCE;
+			else if (g[i] == 1.0f)
+				kind = GAINSPAN_UNITY;
+			else
+				kind = GAINSPAN_SCALE;
+			if (kind != span.kind)
+			{
+				if (span.kind >= 0)
+				{
+					span.end = i;
+					plan.spans.push_back(span);
+				}
+				span.start = i;
+				span.kind = kind;
+			}
+		}
+		span.end = map_x.cols;
+		plan.spans.push_back(span);
+		plan.rowstart.push_back((int)plan.spans.size());
+	}
+
+	plan.decode.resize(256);
+	plan.encode.resize(4096);
+	if (gamma != 1.0f)
+	{
+		for (int v = 0; v < 256; v++)
+			plan.decode[v] = 4095.0f * powf(v / 255.0f, gamma);
+		for (int l = 0; l < 4096; l++)
+			plan.encode[l] = saturate_cast<uchar>(255.0f * powf(l / 4095.0f, 1.0f / gamma));
+	}
+}
+
+// fixed point bilinear sample at x + fx/32, y + fy/32, the weights sum to 1024
+// like cv::remap's INTER_LINEAR tables, taps outside the source are black
+template<int cn> static inline void bilinear_taps(const Mat &src, int x, int y, int fx, int fy, int *sum)
+{
+	const int w00 = (INTER_TAB_SIZE - fx) * (INTER_TAB_SIZE - fy), w01 = fx * (INTER_TAB_SIZE - fy);
+	const int w10 = (INTER_TAB_SIZE - fx) * fy, w11 = fx * fy;
+	if (x >= 0 && y >= 0 && x < src.cols - 1 && y < src.rows - 1)
+	{
+		const uchar *p0 = src.data + y * src.step + x * cn;
+		const uchar *p1 = p0 + src.step;
+		for (int c = 0; c < cn; c++)
+			sum[c] = p0[c] * w00 + p0[c + cn] * w01 + p1[c] * w10 + p1[c + cn] * w11;
+		return;
+	}
+	const int tx[4] = { x, x + 1, x, x + 1 }, ty[4] = { y, y, y + 1, y + 1 };
+	const int tw[4] = { w00, w01, w10, w11 };
+	for (int c = 0; c < cn; c++)
+		sum[c] = 0;
+	for (int t = 0; t < 4; t++)
+	{
+		if (tx[t] < 0 || ty[t] < 0 || tx[t] >= src.cols || ty[t] >= src.rows)
+			continue;
+		const uchar *p = src.data + ty[t] * src.step + tx[t] * cn;
+		for (int c = 0; c < cn; c++)
+			sum[c] += p[c] * tw[t];
+	}
+}
+
+template<int cn> static void gain_remap_rows(const Mat &src, Mat &dst, const GainRemap &plan, const Range &r)
+{
+	const bool gammascale = plan.gamma != 1.0f;
+	const float *decode = &plan.decode[0];
+	const uchar *encode = &plan.encode[0];
+
+	for (int j = r.start; j < r.end; j++)
+	{
+		uchar *d = dst.ptr<uchar>(j);
+		const Vec2s *m1 = plan.map1.ptr<Vec2s>(j);
+		const ushort *m2 = plan.map2.ptr<ushort>(j);
+		const float *g = plan.gain.ptr<float>(j);
+		for (int s = plan.rowstart[j]; s < plan.rowstart[j + 1]; s++)
+		{
+			const GainSpan &span = plan.spans[s];
+			if (span.kind == GAINSPAN_NOSOURCE)
+			{
+				memset(d + span.start * cn, 0, (span.end - span.start) * cn);
+				continue;
+			}
+			for (int i = span.start; i < span.end; i++)
+			{
+				int sum[cn];
+				bilinear_taps<cn>(src, m1[i][0], m1[i][1], m2[i] & (INTER_TAB_SIZE - 1), m2[i] >> INTER_BITS, sum);
+
+				uchar *o = d + i * cn;
+				const int shift = 2 * INTER_BITS;
+				if (span.kind == GAINSPAN_UNITY)
+				{
+					for (int c = 0; c < cn; c++)
+						o[c] = (uchar)((sum[c] + (1 << (shift - 1))) >> shift);
+				}
+				else if (!gammascale)
+				{
+					const float k = g[i] / (1 << shift);
+					for (int c = 0; c < cn; c++)
+						o[c] = saturate_cast<uchar>(sum[c] * k);
+				}
+				else
+				{
+					for (int c = 0; c < cn; c++)
+					{
+						int v = (sum[c] + (1 << (shift - 1))) >> shift;
+						int l = cvRound(decode[v] * g[i]);
+						o[c] = encode[l > 4095 ? 4095 : l];
+					}
+				}
+			}
+		}
+	}
+}
+
+void gain_remap(const Mat &src, Mat &dst, const GainRemap &plan)
+{
+	CV_Assert(src.depth() == CV_8U && src.size() == plan.srcsize);
+	dst.create(plan.map1.size(), src.type());
+
+	parallel_for_(Range(0, dst.rows), [&](const Range &r)
+	{
+		switch (src.channels())
+		{
+		case 1:
+			gain_remap_rows<1>(src, dst, plan, r);
+			break;
+		case 3:
+			gain_remap_rows<3>(src, dst, plan, r);
+			break;
+		case 4:
+			gain_remap_rows<4>(src, dst, plan, r);
+			break;
+		default:
+			CV_Error(Error::StsBadArg, "gain_remap needs 1, 3 or 4 channels");
+		}
+	});
+}
+
+void plan_mesh_warp(const WarpMesh &mesh, Size srcsize, Size dstsize, MeshWarp &plan)
+{
+	plan.srcsize = srcsize;
+	plan.dstsize = dstsize;
+	plan.nx = mesh.nx;
+	plan.ny = mesh.ny;
+	plan.uv.create(mesh.ny, mesh.nx, CV_32FC2);
+	plan.gain.create(mesh.ny, mesh.nx, CV_32F);
+	for (int j = 0; j < mesh.ny; j++)
+	{
+		// mesh row 0 is the bottom of the output
+		const Vec2f *uv = mesh.uv.ptr<Vec2f>(mesh.ny - 1 - j);
+		const float *in = mesh.intensity.ptr<float>(mesh.ny - 1 - j);
+		Vec2f *puv = plan.uv.ptr<Vec2f>(j);
+		float *pg = plan.gain.ptr<float>(j);
+		for (int i = 0; i < mesh.nx; i++)
+		{
+			puv[i] = Vec2f(uv[i][0] * srcsize.width - 0.5f, (1.0f - uv[i][1]) * srcsize.height - 0.5f);
+			pg[i] = in[i];
+		}
+	}
+
+	// same cell choice as warped_from_fisheye_map, cells too narrow for a pixel are empty
+	const float sx = dstsize.width > 1 ? (float)(mesh.nx - 1) / (dstsize.width - 1) : 0;
+	plan.cellstart.assign(mesh.nx, -1);
+	plan.cellstart[mesh.nx - 1] = dstsize.width;
+	for (int i = dstsize.width - 1; i >= 0; i--)
+		plan.cellstart[std::min((int)(i * sx), mesh.nx - 2)] = i;
+	for (int k = mesh.nx - 2; k >= 0; k--)
+	{
+		if (plan.cellstart[k] < 0)
+			plan.cellstart[k] = plan.cellstart[k + 1];
+	}
+}
+
+template<int cn> static void mesh_warp_rows(const Mat &src, Mat &dst, const MeshWarp &plan, bool blend, const Range &r)
+{
+	const int nx = plan.nx, ny = plan.ny;
+	const float sx = plan.dstsize.width > 1 ? (float)(nx - 1) / (plan.dstsize.width - 1) : 0;
+	const float sy = plan.dstsize.height > 1 ? (float)(ny - 1) / (plan.dstsize.height - 1) : 0;
+	const int shift = 2 * INTER_BITS;
+	std::vector<Vec2f> rowuv(nx);
+	std::vector<float> rowg(nx);
+
+	for (int j = r.start; j < r.end; j++)
+	{
+		float gy = j * sy;
+		int y0 = std::min((int)gy, ny - 2);
+		float fy = gy - y0;
+		const Vec2f *uv0 = plan.uv.ptr<Vec2f>(y0);
+		const Vec2f *uv1 = plan.uv.ptr<Vec2f>(y0 + 1);
+		const float *g0 = plan.gain.ptr<float>(y0);
+		const float *g1 = plan.gain.ptr<float>(y0 + 1);
+		for (int k = 0; k < nx; k++)
+		{
+			rowuv[k] = uv0[k] * (1 - fy) + uv1[k] * fy;
+			rowg[k] = (g0[k] < 0 || g1[k] < 0) ? -1.0f : g0[k] * (1 - fy) + g1[k] * fy;
+		}
+
+		uchar *d = dst.ptr<uchar>(j);
+		for (int k = 0; k < nx - 1; k++)
+		{
+			const int i0 = plan.cellstart[k], i1 = plan.cellstart[k + 1];
+			if (i0 >= i1)
+				continue;
+			if (rowg[k] < 0 || rowg[k + 1] < 0)
+			{
+				memset(d + i0 * cn, 0, (i1 - i0) * cn);
+				continue;
+			}
+			// across one cell the co-ords are linear in the output column
+			const Vec2f duv = (rowuv[k + 1] - rowuv[k]) * sx;
+			const float dg = (rowg[k + 1] - rowg[k]) * sx;
+			const float fx0 = i0 * sx - k;
+			Vec2f pos = rowuv[k] + (rowuv[k + 1] - rowuv[k]) * fx0;
+			float g = rowg[k] + (rowg[k + 1] - rowg[k]) * fx0;
+			for (int i = i0; i < i1; i++, pos += duv, g += dg)
+			{
+				const int ix = cvRound(pos[0] * INTER_TAB_SIZE), iy = cvRound(pos[1] * INTER_TAB_SIZE);
+				int sum[cn];
+				bilinear_taps<cn>(src, ix >> INTER_BITS, iy >> INTER_BITS, ix & (INTER_TAB_SIZE - 1), iy & (INTER_TAB_SIZE - 1), sum);
+				uchar *o = d + i * cn;
+				if (!blend || g == 1.0f)
+				{
+					for (int c = 0; c < cn; c++)
+						o[c] = (uchar)((sum[c] + (1 << (shift - 1))) >> shift);
+				}
+				else
+				{
+					const float kg = g / (1 << shift);
+					for (int c = 0; c < cn; c++)
+						o[c] = saturate_cast<uchar>(sum[c] * kg);
+				}
+			}
+		}
+	}
+}
+
+void mesh_warp(const Mat &src, Mat &dst, const MeshWarp &plan, bool blend)
+{
+	CV_Assert(src.depth() == CV_8U && src.size() == plan.srcsize);
+	dst.create(plan.dstsize, src.type());
+
+	parallel_for_(Range(0, dst.rows), [&](const Range &r)
+	{
+		switch (src.channels())
+		{
+		case 1:
+			mesh_warp_rows<1>(src, dst, plan, blend, r);
+			break;
+		case 3:
+			mesh_warp_rows<3>(src, dst, plan, blend, r);
+			break;
+		case 4:
+			mesh_warp_rows<4>(src, dst, plan, blend, r);
+			break;
+		default:
+			CV_Error(Error::StsBadArg, "mesh_warp needs 1, 3 or 4 channels");
+		}
+	});
+}
+
+void plan_planar_remap(const Mat &map_x, const Mat &map_y, Size srcsize, PlanarRemap &plan)
+{
+	plan.srcsize = srcsize;
+	plan.fill = 0;
+	convertMaps(map_x, map_y, plan.map1, plan.map2, CV_16SC2, false);
+}
+
+// per pixel tap kinds of a planar row
+enum { PLANAR_INSIDE = 0, PLANAR_BORDER = 1, PLANAR_NOSOURCE = 2 };
+
+void planar_remap(const std::vector<Mat> &src, std::vector<Mat> &dst, const PlanarRemap &plan)
+{
+	CV_Assert(!src.empty());
+	const size_t step = src[0].step;
+	for (size_t k = 0; k < src.size(); k++)
+		CV_Assert(src[k].type() == CV_8UC1 && src[k].size() == plan.srcsize && src[k].step == step);
+	dst.resize(src.size());
+	for (size_t k = 0; k < dst.size(); k++)
+		dst[k].create(plan.map1.size(), CV_8UC1);
+	const int W = plan.map1.cols, sw = plan.srcsize.width, sh = plan.srcsize.height;
+	const int shift = 2 * INTER_BITS;
+
+	parallel_for_(Range(0, plan.map1.rows), [&](const Range &r)
+	{
+		std::vector<int> ofs(W);
+		std::vector<int> wts(4 * W);
+		std::vector<uchar> kind(W);
+		for (int j = r.start; j < r.end; j++)
+		{
+			const Vec2s *m1 = plan.map1.ptr<Vec2s>(j);
+			const ushort *m2 = plan.map2.ptr<ushort>(j);
+			// offsets and weights once for all the planes
+			for (int i = 0; i < W; i++)
+			{
+				const int x = m1[i][0], y = m1[i][1];
+				const int fx = m2[i] & (INTER_TAB_SIZE - 1), fy = m2[i] >> INTER_BITS;
+				int *w = &wts[4 * i];
+				w[0] = (INTER_TAB_SIZE - fx) * (INTER_TAB_SIZE - fy);
+				w[1] = fx * (INTER_TAB_SIZE - fy);
+				w[2] = (INTER_TAB_SIZE - fx) * fy;
+				w[3] = fx * fy;
+				if (x >= 0 && y >= 0 && x < sw - 1 && y < sh - 1)
+				{
+					kind[i] = PLANAR_INSIDE;
+					ofs[i] = y * (int)step + x;
+				}
+				else if (x < -1 || y < -1 || x >= sw || y >= sh)
+					kind[i] = PLANAR_NOSOURCE;
+				else
+					kind[i] = PLANAR_BORDER;
+			}
+			for (size_t k = 0; k < src.size(); k++)
+			{
+				const uchar *s = src[k].data;
+				uchar *d = dst[k].ptr<uchar>(j);
+				for (int i = 0; i < W; i++)
+				{
+					const int *w = &wts[4 * i];
+					if (kind[i] == PLANAR_INSIDE)
+					{
+						const uchar *p = s + ofs[i];
+						d[i] = (uchar)((p[0] * w[0] + p[1] * w[1] + p[step] * w[2] + p[step + 1] * w[3]
+							+ (1 << (shift - 1))) >> shift);
+					}
+					else if (kind[i] == PLANAR_BORDER)
+					{
+						// taps outside the source read the fill value
+						const int x = m1[i][0], y = m1[i][1];
+						int sum = 0;
+						for (int t = 0; t < 4; t++)
+						{
+							const int tx = x + (t & 1), ty = y + (t >> 1);
+							const bool in = tx >= 0 && ty >= 0 && tx < sw && ty < sh;
+							sum += (in ? s[ty * step + tx] : plan.fill) * w[t];
+						}
+						d[i] = (uchar)((sum + (1 << (shift - 1))) >> shift);
+					}
+					else
+						d[i] = plan.fill;
+				}
+			}
+		}
+	});
+}
+
+void plan_yuv_remap(const Mat &map_x, const Mat &map_y, Size srcsize, YuvRemap &plan)
+{
+	CV_Assert(srcsize.width % 2 == 0 && srcsize.height % 2 == 0 && map_x.cols % 2 == 0 && map_x.rows % 2 == 0);
+	plan_planar_remap(map_x, map_y, srcsize, plan.luma);
+
+	// each output chroma sample sits at the centre of a 2x2 block of luma
+	// samples, so it reads the mean of their source co-ords, taken from luma
+	// to chroma co-ords (chroma sample c covers luma 2c and 2c + 1)
+	Mat cx(map_x.rows / 2, map_x.cols / 2, CV_32F), cy(map_x.rows / 2, map_x.cols / 2, CV_32F);
+	const float seam = srcsize.width * 0.5f;
+	parallel_for_(Range(0, cx.rows), [&](const Range &r)
+	{
+		for (int j = r.start; j < r.end; j++)
+		{
+			const float *mx0 = map_x.ptr<float>(2 * j), *mx1 = map_x.ptr<float>(2 * j + 1);
+			const float *my0 = map_y.ptr<float>(2 * j), *my1 = map_y.ptr<float>(2 * j + 1);
+			float *ox = cx.ptr<float>(j);
+			float *oy = cy.ptr<float>(j);
+			for (int i = 0; i < cx.cols; i++)
+			{
+				const float x[4] = { mx0[2 * i], mx0[2 * i + 1], mx1[2 * i], mx1[2 * i + 1] };
+				const float y[4] = { my0[2 * i], my0[2 * i + 1], my1[2 * i], my1[2 * i + 1] };
+				float sx = 0, sy = 0;
+				int n = 0;
+				// at the edge of the source, the luma samples which have one.
+				// Across the longitude seam of an equirect the samples are at
+				// both ends of the source, only those on the first one's side are used.
+				int first = -1;
+				for (int k = 0; k < 4; k++)
+				{
+					if (x[k] < -1 || y[k] < -1)
+						continue;
+					if (first < 0)
+						first = k;
+					else if (fabsf(x[k] - x[first]) >= seam)
+						continue;
+					sx += x[k];
+					sy += y[k];
+					n++;
+				}
+				if (n == 0)
+				{
+					ox[i] = oy[i] = OCVW_NOSOURCE;
+					continue;
+				}
+				ox[i] = (sx / n - 0.5f) * 0.5f;
+				oy[i] = (sy / n - 0.5f) * 0.5f;
+			}
+		}
+	});
+	plan_planar_remap(cx, cy, Size(srcsize.width / 2, srcsize.height / 2), plan.chroma);
+
+	// black, as cv::COLOR_BGR2YUV_I420 gives it
+	plan.luma.fill = 16;
+	plan.chroma.fill = 128;
+}
+
+void yuv_remap(const Mat &src, Mat &dst, const YuvRemap &plan)
+{
+	const Size ls = plan.luma.srcsize, ld = plan.luma.map1.size();
+	CV_Assert(src.type() == CV_8UC1 && src.isContinuous() && src.cols == ls.width && src.rows == ls.height * 3 / 2);
+	dst.create(ld.height * 3 / 2, ld.width, CV_8UC1);
+
+	// plane headers into the I420 buffers, U and V are packed at half width
+	const size_t sl = (size_t)ls.area(), dl = (size_t)ld.area();
+	std::vector<Mat> srcy(1, Mat(ls, CV_8UC1, src.data)), dsty(1, Mat(ld, CV_8UC1, dst.data));
+	std::vector<Mat> srcuv, dstuv;
+	srcuv.push_back(Mat(ls.height / 2, ls.width / 2, CV_8UC1, src.data + sl));
+	srcuv.push_back(Mat(ls.height / 2, ls.width / 2, CV_8UC1, src.data + sl + sl / 4));
+	dstuv.push_back(Mat(ld.height / 2, ld.width / 2, CV_8UC1, dst.data + dl));
+	dstuv.push_back(Mat(ld.height / 2, ld.width / 2, CV_8UC1, dst.data + dl + dl / 4));
+
+	planar_remap(srcy, dsty, plan.luma);
+	planar_remap(srcuv, dstuv, plan.chroma);
+}
+
+// difference of map co-ords between neighbours a and c around b, one sided if
+// one of them has no source or is across the equirect seam, 0 if neither
+static inline void map_difference(const float *ax, const float *ay, const float *bx, const float *by,
+	const float *cx, const float *cy, float seam, float &du, float &dv)
+{
+	const bool a = ax && *ax >= -1 && *ay >= -1 && fabsf(*ax - *bx) < seam;
+	const bool c = cx && *cx >= -1 && *cy >= -1 && fabsf(*cx - *bx) < seam;
+	if (a && c)
+	{
+		du = (*cx - *ax) * 0.5f;
+		dv = (*cy - *ay) * 0.5f;
+	}
+	else if (c)
+	{
+		du = *cx - *bx;
+		dv = *cy - *by;
+	}
+	else if (a)
+	{
+		du = *bx - *ax;
+		dv = *by - *ay;
+	}
+	else
+		du = dv = 0;
+}
+
+// the tiles of each level which the taps of plan read, per thread then merged
+static void mark_used_tiles(MipRemap &plan)
+{
+	plan.tilesize = 64;
+	const int ts = plan.tilesize, top = plan.levels - 1;
+	std::vector<Size> grids(plan.levels);
+	for (int L = 0; L < plan.levels; L++)
+		grids[L] = Size((plan.levelsizes[L].width + ts - 1) / ts, (plan.levelsizes[L].height + ts - 1) / ts);
+	std::vector<std::vector<uchar> > used(plan.levels);
+	for (int L = 1; L < plan.levels; L++)
+		used[L].assign(grids[L].area(), 0);
+	std::mutex m;
+
+	parallel_for_(Range(0, plan.map_x.rows), [&](const Range &r)
+	{
+		std::vector<std::vector<uchar> > local(used);
+		for (int j = r.start; j < r.end; j++)
+		{
+			const float *mx = plan.map_x.ptr<float>(j), *my = plan.map_y.ptr<float>(j);
+			const float *lod = plan.lod.ptr<float>(j);
+			const Vec2f *axis = plan.axis.ptr<Vec2f>(j);
+			const uchar *taps = plan.taps.ptr<uchar>(j);
+			for (int i = 0; i < plan.map_x.cols; i++)
+			{
+				if (lod[i] <= 0 || mx[i] < -1 || my[i] < -1)
+					continue;
+				// the same levels and taps as mip_remap_rows
+				const int L0 = std::min((int)lod[i], top), L1 = std::min(L0 + 1, top);
+				const int n = taps[i];
+				for (int L = std::max(L0, 1); L <= L1; L++)
+				{
+					const Size &ls = plan.levelsizes[L];
+					const float sx = (float)ls.width / plan.srcsize.width, sy = (float)ls.height / plan.srcsize.height;
+					for (int k = 0; k < n; k++)
+					{
+						const float t = k - (n - 1) * 0.5f;
+						const float x = (mx[i] + t * axis[i][0] + 0.5f) * sx - 0.5f;
+						const float y = (my[i] + t * axis[i][1] + 0.5f) * sy - 0.5f;
+						// both columns and rows of the bilinear taps
+						const int x0 = std::max((int)floorf(x), 0), x1 = std::min((int)floorf(x) + 1, ls.width - 1);
+						const int y0 = std::max((int)floorf(y), 0), y1 = std::min((int)floorf(y) + 1, ls.height - 1);
+						if (x0 > x1 || y0 > y1)
+							continue;
+						for (int ty = y0 / ts; ty <= y1 / ts; ty++)
+							for (int tx = x0 / ts; tx <= x1 / ts; tx++)
+								local[L][ty * grids[L].width + tx] = 1;
+					}
+				}
+			}
+		}
+		std::lock_guard<std::mutex> lock(m);
+		for (int L = 1; L < plan.levels; L++)
+			for (size_t t = 0; t < used[L].size(); t++)
+				used[L][t] |= local[L][t];
+	});
+
+	plan.usedtiles.assign(plan.levels, std::vector<Point>());
+	for (int L = 1; L < plan.levels; L++)
+		for (size_t t = 0; t < used[L].size(); t++)
+			if (used[L][t])
+				plan.usedtiles[L].push_back(Point((int)t % grids[L].width, (int)t / grids[L].width));
+}
+
+void plan_mip_remap(const Mat &map_x, const Mat &map_y, Size srcsize, MipRemap &plan,
+	int maxlevels, int maxaniso)
+{
+	plan.srcsize = srcsize;
+	plan.map_x = map_x;
+	plan.map_y = map_y;
+	plan.levels = 1;
+	while (plan.levels < maxlevels && std::min(srcsize.width, srcsize.height) >> plan.levels >= 8)
+		plan.levels++;
+	plan.lod.create(map_x.size(), CV_32F);
+	plan.axis.create(map_x.size(), CV_32FC2);
+	plan.taps.create(map_x.size(), CV_8U);
+	const float seam = srcsize.width * 0.5f;
+	const int W = map_x.cols, H = map_x.rows;
+
+	parallel_for_(Range(0, H), [&](const Range &r)
+	{
+		for (int j = r.start; j < r.end; j++)
+		{
+			const float *mx = map_x.ptr<float>(j), *my = map_y.ptr<float>(j);
+			const float *ux = j > 0 ? map_x.ptr<float>(j - 1) : 0, *uy = j > 0 ? map_y.ptr<float>(j - 1) : 0;
+			const float *dx = j < H - 1 ? map_x.ptr<float>(j + 1) : 0, *dy = j < H - 1 ? map_y.ptr<float>(j + 1) : 0;
+			float *lod = plan.lod.ptr<float>(j);
+			Vec2f *axis = plan.axis.ptr<Vec2f>(j);
+			uchar *taps = plan.taps.ptr<uchar>(j);
+			for (int i = 0; i < W; i++)
+			{
+				lod[i] = 0;
+				axis[i] = Vec2f(0, 0);
+				taps[i] = 1;
+				if (mx[i] < -1 || my[i] < -1)
+					continue;
+				// Jacobian columns, the source step for one output pixel across and down
+				float dudx, dvdx, dudy, dvdy;
+				map_difference(i > 0 ? mx + i - 1 : 0, i > 0 ? my + i - 1 : 0, mx + i, my + i,
+					i < W - 1 ? mx + i + 1 : 0, i < W - 1 ? my + i + 1 : 0, seam, dudx, dvdx);
+				map_difference(ux ? ux + i : 0, uy ? uy + i : 0, mx + i, my + i,
+					dx ? dx + i : 0, dy ? dy + i : 0, seam, dudy, dvdy);
+				const float lx = sqrtf(dudx * dudx + dvdx * dvdx), ly = sqrtf(dudy * dudy + dvdy * dvdy);
+				const float major = std::max(lx, ly), minor = std::max(std::min(lx, ly), 1.0f);
+				if (major <= 1.0f)
+					continue;
+				// taps along the major axis, the level from what each tap covers
+				const int n = std::min(maxaniso, (int)ceilf(major / minor));
+				lod[i] = std::min(log2f(major / n), (float)(plan.levels - 1));
+				if (lod[i] < 0)
+					lod[i] = 0;
+				taps[i] = (uchar)n;
+				if (n > 1)
+					axis[i] = lx >= ly ? Vec2f(dudx / n, dvdx / n) : Vec2f(dudy / n, dvdy / n);
+			}
+		}
+	});
+
+	plan.levelsizes.assign(1, srcsize);
+	for (int L = 1; L < plan.levels; L++)
+	{
+		const Size &prev = plan.levelsizes[L - 1];
+		plan.levelsizes.push_back(Size((prev.width + 1) / 2, (prev.height + 1) / 2));
+	}
+	mark_used_tiles(plan);
+}
+
+void build_mip_pyramid(const Mat &src, std::vector<Mat> &pyramid, const MipRemap &plan)
+{
+	CV_Assert(src.size() == plan.srcsize);
+	buildPyramid(src, pyramid, plan.levels - 1);
+}
+
+// bilinear sample of a pyramid level at x, y, weighted by w into acc, outside is black
+template<int cn> static inline void mip_tap(const Mat &img, float x, float y, float w, float *acc)
+{
+	const int x0 = (int)floorf(x), y0 = (int)floorf(y);
+	const float fx = x - x0, fy = y - y0;
+	const float tw[4] = { (1 - fx) * (1 - fy) * w, fx * (1 - fy) * w, (1 - fx) * fy * w, fx * fy * w };
+	for (int t = 0; t < 4; t++)
+	{
+		const int tx = x0 + (t & 1), ty = y0 + (t >> 1);
+		if (tx < 0 || ty < 0 || tx >= img.cols || ty >= img.rows)
+			continue;
+		const uchar *p = img.ptr<uchar>(ty) + tx * cn;
+		for (int c = 0; c < cn; c++)
+			acc[c] += p[c] * tw[t];
+	}
+}
+
+template<int cn> static void mip_remap_rows(const std::vector<Mat> &pyramid, Mat &dst, const MipRemap &plan, const Range &r)
+{
+	// level co-ords from level 0 co-ords, per level
+	std::vector<float> sx(pyramid.size()), sy(pyramid.size());
+	for (size_t L = 0; L < pyramid.size(); L++)
+	{
+		sx[L] = (float)pyramid[L].cols / plan.srcsize.width;
+		sy[L] = (float)pyramid[L].rows / plan.srcsize.height;
+	}
+	const int top = (int)pyramid.size() - 1;
+
+	for (int j = r.start; j < r.end; j++)
+	{
+		const float *mx = plan.map_x.ptr<float>(j), *my = plan.map_y.ptr<float>(j);
+		const float *lod = plan.lod.ptr<float>(j);
+		const Vec2f *axis = plan.axis.ptr<Vec2f>(j);
+		const uchar *taps = plan.taps.ptr<uchar>(j);
+		uchar *d = dst.ptr<uchar>(j);
+		for (int i = 0; i < dst.cols; i++)
+		{
+			float acc[cn];
+			for (int c = 0; c < cn; c++)
+				acc[c] = 0;
+			if (mx[i] >= -1 && my[i] >= -1)
+			{
+				const int L0 = std::min((int)lod[i], top), L1 = std::min(L0 + 1, top);
+				const float f = L1 > L0 ? lod[i] - L0 : 0.0f;
+				const int n = taps[i];
+				for (int k = 0; k < n; k++)
+				{
+					const float t = k - (n - 1) * 0.5f;
+					const float x = mx[i] + t * axis[i][0], y = my[i] + t * axis[i][1];
+					mip_tap<cn>(pyramid[L0], (x + 0.5f) * sx[L0] - 0.5f, (y + 0.5f) * sy[L0] - 0.5f, (1 - f) / n, acc);
+					if (f > 0)
+						mip_tap<cn>(pyramid[L1], (x + 0.5f) * sx[L1] - 0.5f, (y + 0.5f) * sy[L1] - 0.5f, f / n, acc);
+				}
+			}
+			for (int c = 0; c < cn; c++)
+				d[i * cn + c] = saturate_cast<uchar>(acc[c]);
+		}
+	}
+}
+
+void mip_remap(const std::vector<Mat> &pyramid, Mat &dst, const MipRemap &plan)
+{
+	CV_Assert(!pyramid.empty() && pyramid[0].depth() == CV_8U && pyramid[0].size() == plan.srcsize);
+	dst.create(plan.map_x.size(), pyramid[0].type());
+
+	parallel_for_(Range(0, dst.rows), [&](const Range &r)
+	{
+		switch (pyramid[0].channels())
+		{
+		case 1:
+			mip_remap_rows<1>(pyramid, dst, plan, r);
+			break;
+		case 3:
+			mip_remap_rows<3>(pyramid, dst, plan, r);
+			break;
+		case 4:
+			mip_remap_rows<4>(pyramid, dst, plan, r);
+			break;
+		default:
+			CV_Error(Error::StsBadArg, "mip_remap needs 1, 3 or 4 channels");
+		}
+	});
+}
+
+LazyMipPyramid::LazyMipPyramid(const Mat &src, const MipRemap &plan) : plan(plan), built(0)
+{
+	CV_Assert(src.size() == plan.srcsize);
+	const int ts = plan.tilesize;
+	pyramid.resize(plan.levels);
+	grids.resize(plan.levels);
+	once.resize(plan.levels);
+	pyramid[0] = src;
+	for (int L = 1; L < plan.levels; L++)
+	{
+		// allocated, but only the tiles used are ever written
+		pyramid[L].create(plan.levelsizes[L], src.type());
+		grids[L] = Size((plan.levelsizes[L].width + ts - 1) / ts, (plan.levelsizes[L].height + ts - 1) / ts);
+		once[L].reset(new std::once_flag[grids[L].area()]);
+	}
+}
+
+void LazyMipPyramid::ensure(int level, int tx, int ty)
+{
+	if (level == 0)
+		return;
+	std::call_once(once[level][ty * grids[level].width + tx], [&]() { build_tile(level, tx, ty); });
+}
+
+void LazyMipPyramid::build_tile(int level, int tx, int ty)
+{
+	const int ts = plan.tilesize;
+	const Rect tile = Rect(tx * ts, ty * ts, ts, ts) & Rect(Point(0, 0), plan.levelsizes[level]);
+	// the 5x5 pyrDown kernel reaches 2 pixels of the level below past the
+	// tile, take 4 so the tile's own pixels see no false border. Even offsets
+	// keep the sampling grid, and at the edge of the level the border is real.
+	const Size &below = plan.levelsizes[level - 1];
+	const int x0 = std::max(2 * tile.x - 4, 0), y0 = std::max(2 * tile.y - 4, 0);
+	const int x1 = std::min(2 * (tile.x + tile.width) + 4, below.width);
+	const int y1 = std::min(2 * (tile.y + tile.height) + 4, below.height);
+	if (level > 1)
+	{
+		for (int by = y0 / ts; by <= (y1 - 1) / ts; by++)
+			for (int bx = x0 / ts; bx <= (x1 - 1) / ts; bx++)
+				ensure(level - 1, bx, by);
+	}
+	Mat down;
+	pyrDown(pyramid[level - 1](Rect(x0, y0, x1 - x0, y1 - y0)), down);
+	down(Rect(tile.x - x0 / 2, tile.y - y0 / 2, tile.width, tile.height)).copyTo(pyramid[level](tile));
+	built++;
+}
+
+void LazyMipPyramid::build_used()
+{
+	// level by level, so the tiles below are mostly there already
+	for (int L = 1; L < plan.levels; L++)
+	{
+		const std::vector<Point> &tiles = plan.usedtiles[L];
+		parallel_for_(Range(0, (int)tiles.size()), [&](const Range &r)
+		{
+			for (int t = r.start; t < r.end; t++)
+				ensure(L, tiles[t].x, tiles[t].y);
+		});
+	}
+}
+
+void mip_remap(LazyMipPyramid &pyramid, Mat &dst, const MipRemap &plan)
+{
+	pyramid.build_used();
+	mip_remap(pyramid.levels(), dst, plan);
+}
+
+bool plan_streaming_remap(const WarpParams &p, StreamingRemap &plan, int maxsrcrows, int maxdstrows)
+{
+	plan.params = p;
+	plan.bands.clear();
+	if (p.transformtype == 4 || p.transformtype == 5)
+	{
+		if (!read_mesh_file(p.mapfile, plan.mesh))
+		{
+			fprintf(stderr, "Could not read map file %s\n", p.mapfile.c_str());
+			return false;
+		}
+	}
+
+	// source rows read by each output row, the maps a chunk at a time
+	const int H = p.outputsize.height, chunk = 16;
+	std::vector<int> rowsrc0(H), rowsrc1(H);
+	Mat map_x, map_y, gain;
+	plan.srcbox = Rect();
+	for (int y0 = 0; y0 < H; y0 += chunk)
+	{
+		const int y1 = std::min(y0 + chunk, H);
+		if (!build_band_maps(p, plan.mesh, Range(y0, y1), map_x, map_y, gain))
+			return false;
+		for (int j = y0; j < y1; j++)
+		{
+			Rect box = source_box(map_x, map_y, Rect(0, j - y0, map_x.cols, 1), p.inputsize);
+			rowsrc0[j] = box.empty() ? 0 : box.y;
+			rowsrc1[j] = box.empty() ? 0 : box.y + box.height;
+			if (!box.empty())
+				plan.srcbox = plan.srcbox.empty() ? box : (plan.srcbox | box);
+		}
+	}
+
+	// greedy bands, grown while both limits hold
+	for (int j = 0; j < H; )
+	{
+		StreamBand b;
+		b.dst0 = j;
+		b.src0 = rowsrc0[j];
+		b.src1 = rowsrc1[j];
+		for (j++; j < H && j - b.dst0 < maxdstrows; j++)
+		{
+			if (rowsrc0[j] == rowsrc1[j])
+				continue;
+			int s0 = b.src0 == b.src1 ? rowsrc0[j] : std::min(b.src0, rowsrc0[j]);
+			int s1 = b.src0 == b.src1 ? rowsrc1[j] : std::max(b.src1, rowsrc1[j]);
+			if (s1 - s0 > maxsrcrows)
+				break;
+			b.src0 = s0;
+			b.src1 = s1;
+		}
+		b.dst1 = j;
+		plan.bands.push_back(b);
+	}
+	return true;
+}
+
+bool streaming_remap(const StreamingRemap &plan, int srctype, const SourceRows &fetch,
+	const OutputRows &emit, int interpolation, size_t *residentbytes)
+{
+	const WarpParams &p = plan.params;
+	const int x0 = plan.srcbox.x, width = plan.srcbox.width;
+	Mat window, map_x, map_y, gain, out;
+	int w0 = 0, w1 = 0;	// source rows held in window, columns x0 .. x0 + width - 1
+	size_t peak = 0;
+
+	for (size_t k = 0; k < plan.bands.size(); k++)
+	{
+		const StreamBand &b = plan.bands[k];
+		if (!build_band_maps(p, plan.mesh, Range(b.dst0, b.dst1), map_x, map_y, gain))
+			return false;
+
+		if (b.src0 == b.src1)
+		{
+			out.create(b.dst1 - b.dst0, p.outputsize.width, srctype);
+			out.setTo(Scalar::all(0));
+		}
+		else
+		{
+			// keep the rows shared with the previous band, fetch the rest
+			Mat next(b.src1 - b.src0, width, srctype);
+			const int k0 = std::max(b.src0, w0), k1 = std::min(b.src1, w1);
+			if (k0 < k1)
+			{
+				window.rowRange(k0 - w0, k1 - w0).copyTo(next.rowRange(k0 - b.src0, k1 - b.src0));
+				Mat rows;
+				if (b.src0 < k0)
+				{
+					rows = next.rowRange(0, k0 - b.src0);
+					if (!fetch(Rect(x0, b.src0, width, rows.rows), rows))
+						return false;
+				}
+				if (k1 < b.src1)
+				{
+					rows = next.rowRange(k1 - b.src0, b.src1 - b.src0);
+					if (!fetch(Rect(x0, k1, width, rows.rows), rows))
+						return false;
+				}
+			}
+			else if (!fetch(Rect(x0, b.src0, width, next.rows), next))
+				return false;
+			window = next;
+			w0 = b.src0;
+			w1 = b.src1;
+
+			// map co-ords are relative to the window
+			map_x -= (float)x0;
+			map_y -= (float)w0;
+			remap(window, out, map_x, map_y, interpolation, BORDER_CONSTANT, Scalar(0, 0, 0));
+		}
+		peak = std::max(peak, window.total() * window.elemSize() + out.total() * out.elemSize()
+			+ (map_x.total() + map_y.total() + gain.total()) * sizeof(float));
+		if (!emit(b.dst0, out))
+			return false;
+	}
+	if (residentbytes)
+		*residentbytes = peak;
+	return true;
+}
+
+void streaming_remap(const Mat &src, Mat &dst, const StreamingRemap &plan, int interpolation, size_t *residentbytes)
+{
+	CV_Assert(src.size() == plan.params.inputsize);
+	dst.create(plan.params.outputsize, src.type());
+	streaming_remap(plan, src.type(),
+		[&](const Rect &box, Mat &pixels) { src(box).copyTo(pixels); return true; },
+		[&](int y0, const Mat &rows) { rows.copyTo(dst.rowRange(y0, y0 + rows.rows)); return true; },
+		interpolation, residentbytes);
+}
@@ -0,0 +1,222 @@
+#ifndef OCVWARPREMAP_H
+#define OCVWARPREMAP_H
+
+/*
+ * Remap engines for OCVWarp, used instead of a single cv::remap call
+ * on large (4K, 8K) fulldome frames.
+ *
+ */
+
+#include <vector>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <opencv2/opencv.hpp>
+
+#include "ocvwarpmaps.h"
+
+// Tiled, cache-blocked remap.
+// The output is cut into tiles, each tile gets the bounding box of the
+// source pixels it reads, and the tiles are binned by source region so that
+// one worker processes all the tiles which read the same part of the source
+// one after another, while those source lines are still in cache.
+struct TiledRemap
+{
+	cv::Size srcsize;
+	cv::Size dstsize;
+	cv::Size tilesize;
+	cv::Size binsize;
+	std::vector<cv::Rect> dsttiles;	// in processing order
+	std::vector<cv::Rect> srcboxes;	// source bounding box of each tile, empty if no source
+	std::vector<int> binstart;	// tiles binstart[b] .. binstart[b+1]-1 are bin b
+	cv::Mat map1, map2;		// fixed point maps from cv::convertMaps
+};
+
+// binsize is the source area one bin covers, about 128 KB of CV_8UC3 by default
+void plan_tiled_remap(const cv::Mat &map_x, const cv::Mat &map_y, cv::Size srcsize,
+	TiledRemap &plan, cv::Size tilesize = cv::Size(64, 32), cv::Size binsize = cv::Size(256, 128));
+
+void tiled_remap(const cv::Mat &src, cv::Mat &dst, const TiledRemap &plan,
+	int interpolation = cv::INTER_LINEAR);
+
+// Bilinear remap with the mesh intensity (edge blend) applied in the same pass.
+// Each row is split into spans with no source (cleared), unity gain (plain
+// bilinear) and other gains, so the multiply is skipped where gain is exactly 1.
+struct GainSpan
+{
+	int start, end;
+	int kind;	// GAINSPAN_NOSOURCE, GAINSPAN_UNITY or GAINSPAN_SCALE
+};
+enum { GAINSPAN_NOSOURCE = 0, GAINSPAN_UNITY = 1, GAINSPAN_SCALE = 2 };
+
+struct GainRemap
+{
+	cv::Size srcsize;
+	cv::Mat map1, map2;		// fixed point maps from cv::convertMaps
+	cv::Mat gain;			// CV_32F, per output pixel
+	std::vector<GainSpan> spans;
+	std::vector<int> rowstart;	// spans of row j are rowstart[j] .. rowstart[j+1]-1
+	float gamma;			// 1 scales the pixel values, otherwise scaling is done in linear light
+	std::vector<float> decode;	// 256 entries, 8 bit value to linear in 0..4095
+	std::vector<cv::uchar> encode;	// 4096 entries, linear back to 8 bit
+};
+
+void plan_gain_remap(const cv::Mat &map_x, const cv::Mat &map_y, const cv::Mat &gain,
+	cv::Size srcsize, float gamma, GainRemap &plan);
+
+// src is CV_8UC1, CV_8UC3 or CV_8UC4, border is black
+void gain_remap(const cv::Mat &src, cv::Mat &dst, const GainRemap &plan);
+
+// Transformtype 4 straight from the warp mesh, without full size maps.
+// Only the mesh is kept, in source pixel co-ords. For each output row the two
+// mesh rows around it are interpolated once, then the source co-ords are
+// stepped along the row by forward differencing within each mesh cell.
+// Matches warped_from_fisheye_map followed by a bilinear remap.
+struct MeshWarp
+{
+	cv::Size srcsize;
+	cv::Size dstsize;
+	int nx, ny;
+	cv::Mat uv;			// CV_32FC2, ny x nx, source pixel co-ords, row 0 at the top
+	cv::Mat gain;			// CV_32F, ny x nx, negative where the node is not used
+	std::vector<int> cellstart;	// first output column of each mesh cell, nx entries, the last is dstsize.width
+};
+
+void plan_mesh_warp(const WarpMesh &mesh, cv::Size srcsize, cv::Size dstsize, MeshWarp &plan);
+
+// src is CV_8UC1, CV_8UC3 or CV_8UC4, blend scales by the mesh intensity
+void mesh_warp(const cv::Mat &src, cv::Mat &dst, const MeshWarp &plan, bool blend = false);
+
+// Planar bilinear remap. On interleaved CV_8UC3 every tap is a 3 byte stride
+// gather; here the frame is split into planes once, the source offset and
+// weights of each output pixel are worked out once per row, and then applied
+// to every plane as a plain one byte gather. Any number of CV_8UC1 planes of
+// srcsize with the same step, e.g. from cv::split.
+struct PlanarRemap
+{
+	cv::Size srcsize;
+	cv::Mat map1, map2;		// fixed point maps from cv::convertMaps
+	cv::uchar fill;			// value outside the source, 0 unless set after planning
+};
+
+void plan_planar_remap(const cv::Mat &map_x, const cv::Mat &map_y, cv::Size srcsize, PlanarRemap &plan);
+
+void planar_remap(const std::vector<cv::Mat> &src, std::vector<cv::Mat> &dst, const PlanarRemap &plan);
+
+// Remap of YUV 4:2:0 (I420) frames, as from cv::COLOR_BGR2YUV_I420 - a
+// (height * 3 / 2) x width CV_8UC1 Mat, the Y plane followed by U and V at
+// half resolution. Luma uses the maps as they are, chroma a half resolution
+// map derived from them, so no colour conversion is needed around the warp.
+// Both sizes must be even.
+struct YuvRemap
+{
+	PlanarRemap luma;
+	PlanarRemap chroma;
+};
+
+void plan_yuv_remap(const cv::Mat &map_x, const cv::Mat &map_y, cv::Size srcsize, YuvRemap &plan);
+
+void yuv_remap(const cv::Mat &src, cv::Mat &dst, const YuvRemap &plan);
+
+// Minification aware remap. Where the maps shrink the source (the poles for
+// equirect to fisheye), a single bilinear tap per output pixel aliases. The
+// footprint of each output pixel is taken from the map Jacobian; it is
+// sampled from a mip pyramid of the source at the level of the footprint's
+// minor axis, with up to maxaniso taps along the major axis, blending the
+// two nearest levels (trilinear, a cheap stand-in for EWA).
+struct MipRemap
+{
+	cv::Size srcsize;
+	int levels;			// pyramid levels, including the source
+	cv::Mat map_x, map_y;		// CV_32F, level 0 source co-ords
+	cv::Mat lod;			// CV_32F, level of detail, 0 where not minified
+	cv::Mat axis;			// CV_32FC2, level 0 step between the taps along the major axis
+	cv::Mat taps;			// CV_8U, number of taps, 1 where isotropic
+	// what the remap reads of each pyramid level, for LazyMipPyramid
+	int tilesize;
+	std::vector<cv::Size> levelsizes;		// as cv::pyrDown makes them
+	std::vector<std::vector<cv::Point> > usedtiles;	// per level, empty for the source
+};
+
+void plan_mip_remap(const cv::Mat &map_x, const cv::Mat &map_y, cv::Size srcsize, MipRemap &plan,
+	int maxlevels = 8, int maxaniso = 4);
+
+// pyramid[0] is src, then cv::pyrDown levels, plan.levels in all
+void build_mip_pyramid(const cv::Mat &src, std::vector<cv::Mat> &pyramid, const MipRemap &plan);
+
+// pyramid of CV_8UC1, CV_8UC3 or CV_8UC4, border is black
+void mip_remap(const std::vector<cv::Mat> &pyramid, cv::Mat &dst, const MipRemap &plan);
+
+// Mip pyramid of one frame, built a tile at a time and only where needed.
+// Usually only the polar bands of an equirect are minified, so most of each
+// level is never read. A tile is made with cv::pyrDown from the tiles of the
+// level below it, which are made first if need be, and gives the same pixels
+// as the whole level would. Any number of threads may share one pyramid,
+// each tile is built once.
+class LazyMipPyramid
+{
+public:
+	LazyMipPyramid(const cv::Mat &src, const MipRemap &plan);
+
+	// makes tile (tx, ty) of level (and what it needs) if not done yet
+	void ensure(int level, int tx, int ty);
+	// all the tiles plan.usedtiles lists, in parallel
+	void build_used();
+	const std::vector<cv::Mat> &levels() const { return pyramid; }
+	int tiles_built() const { return built; }
+
+private:
+	void build_tile(int level, int tx, int ty);
+
+	const MipRemap &plan;
+	std::vector<cv::Mat> pyramid;
+	std::vector<cv::Size> grids;				// tiles across and down, per level
+	std::vector<std::unique_ptr<std::once_flag[]> > once;	// per level, per tile
+	std::atomic<int> built;
+};
+
+// samples through the tiles already built, build_used first
+void mip_remap(LazyMipPyramid &pyramid, cv::Mat &dst, const MipRemap &plan);
+
+// Streaming band remap, for frames too big to hold whole per worker.
+// The output is made in bands of rows. The maps of a band are generated just
+// before it is remapped, and only the source rows the band reads are resident
+// (and of those only the columns within the frame's source box),
+// so memory depends on the band limits and not on the frame size. Bands are
+// cut so that none reads more than maxsrcrows source rows (unless a single
+// output row does) and consecutive bands keep the source rows they share.
+// Always the single stage (fused) maps, the mesh intensity is not applied.
+// The warp and batch modes use it with --stream, see prepare_frame_warp.
+struct StreamBand
+{
+	int dst0, dst1;			// output rows dst0 .. dst1-1
+	int src0, src1;			// read source rows src0 .. src1-1, src0 == src1 if none
+};
+
+struct StreamingRemap
+{
+	WarpParams params;
+	WarpMesh mesh;			// transformtype 4 and 5
+	std::vector<StreamBand> bands;
+	cv::Rect srcbox;		// all the source read, only these columns are fetched
+};
+
+// fills pixels (preallocated, source type) with the source within box
+typedef std::function<bool(const cv::Rect &box, cv::Mat &pixels)> SourceRows;
+// takes finished output rows y0 .. y0 + rows.rows - 1
+typedef std::function<bool(int y0, const cv::Mat &rows)> OutputRows;
+
+bool plan_streaming_remap(const WarpParams &p, StreamingRemap &plan,
+	int maxsrcrows = 256, int maxdstrows = 64);
+
+// false if fetch or emit fail. residentbytes, if given, gets the most memory
+// held at once - source rows, band maps and the output band
+bool streaming_remap(const StreamingRemap &plan, int srctype, const SourceRows &fetch,
+	const OutputRows &emit, int interpolation = cv::INTER_LINEAR, size_t *residentbytes = 0);
+
+// the same with whole frames, for comparing with warp_frame
+void streaming_remap(const cv::Mat &src, cv::Mat &dst, const StreamingRemap &plan,
+	int interpolation = cv::INTER_LINEAR, size_t *residentbytes = 0);
+
+#endif
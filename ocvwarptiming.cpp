@@ -0,0 +1,142 @@
+/*
+ * Per stage frame timing for OCVWarp. See ocvwarptiming.h
+ *
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+
+#include "ocvwarptiming.h"
+
+const char *stage_name(int stage)
+{
+	static const char *names[STAGE_COUNT] = { "decode", "maps", "warp", "encode" };
+	return stage >= 0 && stage < STAGE_COUNT ? names[stage] : "?";
+}
+
+StageTimes::StageTimes()
+	: stopping(false)
+{
+	for (int s = 0; s < STAGE_COUNT; s++)
+	{
+		for (int b = 0; b < BINS; b++)
+			bins[s][b] = 0;
+		counts[s] = 0;
+		totalus[s] = 0;
+		maxus[s] = 0;
+	}
+}
+
+StageTimes::~StageTimes()
+{
+	stop_printing();
+}
+
+void StageTimes::add(int stage, double ms)
+{
+	const long long us = (long long)(ms * 1000.0 + 0.5);
+	int b = us > 1 ? (int)(log10((double)us) * BINSPERDECADE) : 0;
+	b = b < BINS ? b : BINS - 1;
+	bins[stage][b]++;
+	counts[stage]++;
+	totalus[stage] += us;
+	long long seen = maxus[stage];
+	while (us > seen && !maxus[stage].compare_exchange_weak(seen, us))
+		;
+}
+
+double StageTimes::mean(int stage) const
+{
+	long long n = counts[stage];
+	return n > 0 ? totalus[stage] / 1000.0 / n : 0.0;
+}
+
+double StageTimes::percentile(int stage, double q) const
+{
+	long long n = counts[stage];
+	if (n == 0)
+		return 0.0;
+	long long want = (long long)ceil(q * n), seen = 0;
+	for (int b = 0; b < BINS; b++)
+	{
+		seen += bins[stage][b];
+		// the bin's geometric centre, never past the largest time seen
+		if (seen >= want)
+			return std::min(pow(10.0, (b + 0.5) / BINSPERDECADE), (double)maxus[stage]) / 1000.0;
+	}
+	return maxus[stage] / 1000.0;
+}
+
+void StageTimes::print(FILE *out) const
+{
+	fprintf(out, "  stage     frames   mean ms    p50 ms    p95 ms    p99 ms    max ms\n");
+	for (int s = 0; s < STAGE_COUNT; s++)
+	{
+		if (counts[s] == 0)
+			continue;
+		fprintf(out, "  %-7s %8lld %9.2f %9.2f %9.2f %9.2f %9.2f\n", stage_name(s), (long long)counts[s],
+			mean(s), percentile(s, 0.5), percentile(s, 0.95), percentile(s, 0.99), maxus[s] / 1000.0);
+	}
+}
+
+bool StageTimes::write_report(const std::string &path) const
+{
+	FILE *out = fopen(path.c_str(), "w");
+	if (!out)
+		return false;
+	const bool json = path.size() > 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+	if (json)
+		fprintf(out, "{\n  \"stages\": [\n");
+	else
+		fprintf(out, "stage,frames,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+	bool first = true;
+	for (int s = 0; s < STAGE_COUNT; s++)
+	{
+		if (counts[s] == 0)
+			continue;
+		if (json)
+		{
+			fprintf(out, "%s    { \"stage\": \"%s\", \"frames\": %lld, \"mean_ms\": %.3f, \"p50_ms\": %.3f, "
+				"\"p95_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f }", first ? "" : ",\n",
+				stage_name(s), (long long)counts[s], mean(s), percentile(s, 0.5), percentile(s, 0.95),
+				percentile(s, 0.99), maxus[s] / 1000.0);
+		}
+		else
+		{
+			fprintf(out, "%s,%lld,%.3f,%.3f,%.3f,%.3f,%.3f\n", stage_name(s), (long long)counts[s], mean(s),
+				percentile(s, 0.5), percentile(s, 0.95), percentile(s, 0.99), maxus[s] / 1000.0);
+		}
+		first = false;
+	}
+	if (json)
+		fprintf(out, "\n  ]\n}\n");
+	return fclose(out) == 0;
+}
+
+void StageTimes::start_printing(double seconds, FILE *out)
+{
+	stop_printing();
+	stopping = false;
+	printer = std::thread([this, seconds, out]()
+	{
+		std::unique_lock<std::mutex> lock(m);
+		while (!wake.wait_for(lock, std::chrono::duration<double>(seconds), [this]() { return stopping; }))
+		{
+			fprintf(out, "\n");
+			print(out);
+		}
+	});
+}
+
+void StageTimes::stop_printing()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		stopping = true;
+		wake.notify_all();
+	}
+	if (printer.joinable())
+		printer.join();
+}
@@ -0,0 +1,88 @@
+#ifndef OCVWARPTIMING_H
+#define OCVWARPTIMING_H
+
+/*
+ * Per stage frame timing for OCVWarp - how long each frame spends being
+ * decoded, getting its maps, warped and encoded, as histograms with
+ * percentiles, printed while running and written out as JSON or CSV.
+ *
+ */
+
+#include <stdio.h>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <opencv2/opencv.hpp>
+
+enum
+{
+	STAGE_DECODE = 0,
+	STAGE_MAPS,		// maps for the frame, when the angles change per frame
+	STAGE_WARP,
+	STAGE_ENCODE,
+	STAGE_COUNT
+};
+
+const char *stage_name(int stage);
+
+// Histograms of per frame stage times, which any number of threads may add
+// to. Bins are log spaced, 20 per decade from 1 us to 100 s, and percentiles
+// are the geometric centre of a bin, so within about 6%. Adding a time is a
+// few atomic increments.
+class StageTimes
+{
+public:
+	StageTimes();
+	~StageTimes();
+
+	void add(int stage, double ms);
+	long long count(int stage) const { return counts[stage]; }
+	double mean(int stage) const;
+	// q in 0..1, the centre of the bin holding that fraction of the times,
+	// at most the max
+	double percentile(int stage, double q) const;
+
+	// a line per stage of count, mean, p50, p95, p99 and max
+	void print(FILE *out) const;
+	// by the extension of path, .json or anything else for CSV
+	bool write_report(const std::string &path) const;
+
+	// prints every seconds on its own thread, until stop_printing
+	void start_printing(double seconds, FILE *out = stderr);
+	void stop_printing();
+
+	enum { BINS = 160, BINSPERDECADE = 20 };
+
+private:
+	std::atomic<long long> bins[STAGE_COUNT][BINS];
+	std::atomic<long long> counts[STAGE_COUNT];
+	std::atomic<long long> totalus[STAGE_COUNT];
+	std::atomic<long long> maxus[STAGE_COUNT];
+
+	std::thread printer;
+	std::mutex m;
+	std::condition_variable wake;
+	bool stopping;
+};
+
+// times its own scope into stage of times, nothing if times is 0
+class ScopedStageTimer
+{
+public:
+	ScopedStageTimer(StageTimes *times, int stage)
+		: times(times), stage(stage), t0(times ? cv::getTickCount() : 0) {}
+	~ScopedStageTimer()
+	{
+		if (times)
+			times->add(stage, (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency());
+	}
+
+private:
+	StageTimes *times;
+	int stage;
+	cv::int64 t0;
+};
+
+#endif